@@ -0,0 +1,65 @@
+#ifndef ACTIVATION_HPP
+#define ACTIVATION_HPP
+
+#include <cmath>
+
+namespace Malphax
+{
+    enum class Activation
+    {
+        Identity,
+        ReLU,
+        GELU,
+        Tanh
+    };
+
+    // Scalar activations for the epilogues of fused layers. Each derivative is taken from whatever the layer keeps:
+    // the output for ReLU and tanh, the pre-activation for GELU.
+    namespace activation
+    {
+        template<typename eT>
+        eT apply(Activation act, eT z)
+        {
+            switch (act)
+            {
+                case Activation::ReLU:
+                    return z > eT(0) ? z : eT(0);
+                case Activation::GELU:
+                    return eT(0.5) * z * (eT(1) + std::erf(z * eT(0.70710678118654752440)));
+                case Activation::Tanh:
+                    return std::tanh(z);
+                default:
+                    return z;
+            }
+        }
+
+        template<typename eT>
+        eT relu_derivative(eT y)
+        {
+            return y > eT(0) ? eT(1) : eT(0);
+        }
+
+        template<typename eT>
+        eT tanh_derivative(eT y)
+        {
+            return eT(1) - y * y;
+        }
+
+        // Phi(z) + z * phi(z), the exact (erf) form.
+        template<typename eT>
+        eT gelu_derivative(eT z)
+        {
+            const eT cdf = eT(0.5) * (eT(1) + std::erf(z * eT(0.70710678118654752440)));
+            const eT pdf = eT(0.39894228040143267794) * std::exp(eT(-0.5) * z * z);
+            return cdf + z * pdf;
+        }
+
+        // True when the derivative is read off the pre-activation rather than the output.
+        inline bool needs_input(Activation act)
+        {
+            return act == Activation::GELU;
+        }
+    }
+}
+
+#endif // ACTIVATION_HPP
\ No newline at end of file
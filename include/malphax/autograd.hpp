@@ -3,7 +3,15 @@
 
 #include "base.hpp"
 #include "tensor.hpp"
+#include "broadcast.hpp"
+#include "kernels.hpp"
+#include "reduction.hpp"
+#include "activation.hpp"
+#include <cmath>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 #include <armadillo>
 
@@ -11,101 +19,178 @@ namespace Malphax
 {
     namespace autograd
     {
+        template<typename eT>
         class Add_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> B_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
-            Tensor *B;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            BasicTensorImpl<eT> *C_impl;
 
-            Add_(Tensor *A, Tensor *B, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), B(B), A_impl(A->get_impl()), B_impl(B->get_impl()), C_impl(C_impl)
+            Add_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                 BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), B_impl(B_impl), C_impl(C_impl)
             {
                 set_inputs(A_impl, B_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad) A_impl->grad += C_impl->grad;
-                if (B_impl->requires_grad) B_impl->grad += C_impl->grad;
+                const arma::Mat<eT> &g = C_impl->grad;
+
+                if (A_impl->needs_grad(C_impl))
+                {
+                    if (A_impl->shaped_like(g))
+                        A_impl->accumulate_grad(g);
+                    else
+                        A_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols,
+                                                          [&g](arma::uword i, arma::uword j) { return g.at(i, j); });
+                }
+
+                if (B_impl->needs_grad(C_impl))
+                {
+                    if (B_impl->shaped_like(g))
+                        B_impl->accumulate_grad(g);
+                    else
+                        B_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols,
+                                                          [&g](arma::uword i, arma::uword j) { return g.at(i, j); });
+                }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A, B};
+                return SavesNothing;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                B_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class Sub_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> B_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
-            Tensor *B;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            BasicTensorImpl<eT> *C_impl;
 
-            Sub_(Tensor *A, Tensor *B, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), B(B), A_impl(A->get_impl()), B_impl(B->get_impl()), C_impl(C_impl)
+            Sub_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                 BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), B_impl(B_impl), C_impl(C_impl)
             {
                 set_inputs(A_impl, B_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad) A_impl->grad += C_impl->grad;
-                if (B_impl->requires_grad) B_impl->grad -= C_impl->grad;
+                const arma::Mat<eT> &g = C_impl->grad;
+
+                if (A_impl->needs_grad(C_impl))
+                {
+                    if (A_impl->shaped_like(g))
+                        A_impl->accumulate_grad(g);
+                    else
+                        A_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols,
+                                                          [&g](arma::uword i, arma::uword j) { return g.at(i, j); });
+                }
+
+                if (B_impl->needs_grad(C_impl))
+                {
+                    if (B_impl->shaped_like(g))
+                        B_impl->subtract_grad(g);
+                    else
+                        B_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols,
+                                                          [&g](arma::uword i, arma::uword j) { return -g.at(i, j); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
             }
 
-            std::vector<Tensor *> parents() override
+            void release_saved() override
             {
-                return {A, B};
+                A_impl.reset();
+                B_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class MatMul_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> B_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
-            Tensor *B;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            BasicTensorImpl<eT> *C_impl;
+            bool trans_A;
+            bool trans_B;
 
-            MatMul_(Tensor *A, Tensor *B, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), B(B), A_impl(A->get_impl()), B_impl(B->get_impl()), C_impl(C_impl)
+            MatMul_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                    BasicTensorImpl<eT> *C_impl, bool trans_A = false, bool trans_B = false)
+                    : A_impl(A_impl), B_impl(B_impl), C_impl(C_impl), trans_A(trans_A), trans_B(trans_B)
             {
 
                 set_inputs(A_impl, B_impl);
             }
 
+            // With C = op(A) * op(B), each gradient is a single gemm straight into the gradient buffer, transposes
+            // being passed to BLAS as flags: dA (+)= dC * op(B)^T, or op(B) * dC^T when A enters transposed, and
+            // likewise for B.
             void backward() override
             {
+                const arma::Mat<eT> &g = C_impl->grad;
+                const arma::Mat<eT> &a = A_impl->data;
+                const arma::Mat<eT> &b = B_impl->data;
 
-                if (A_impl->requires_grad) A_impl->grad += C_impl->grad * B_impl->data.t();
+                if (A_impl->needs_grad(C_impl))
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            if (trans_A)
+                                                kernels::gemm(grad, overwrite, b, trans_B, g, true);
+                                            else
+                                                kernels::gemm(grad, overwrite, g, false, b, !trans_B);
+                                        });
 
-                if (B_impl->requires_grad) B_impl->grad += A_impl->data.t() * C_impl->grad;
+                if (B_impl->needs_grad(C_impl))
+                    B_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            if (trans_B)
+                                                kernels::gemm(grad, overwrite, g, true, a, trans_A);
+                                            else
+                                                kernels::gemm(grad, overwrite, a, !trans_A, g, false);
+                                        });
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A, B};
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                B_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class Dot_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> B_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
-            Tensor *B;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            BasicTensorImpl<eT> *C_impl;
 
-            Dot_(Tensor *A, Tensor *B, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), B(B), A_impl(A->get_impl()), B_impl(B->get_impl()), C_impl(C_impl)
+            Dot_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                 BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), B_impl(B_impl), C_impl(C_impl)
             {
 
                 set_inputs(A_impl, B_impl);
@@ -113,306 +198,1188 @@ namespace Malphax
 
             void backward() override
             {
-                if (A_impl->data.n_rows == B_impl->data.n_rows && A_impl->data.n_cols == B_impl->data.n_cols)
-                {
-                    if (A_impl->requires_grad) A_impl->grad += C_impl->grad % B_impl->data;
-                    if (B_impl->requires_grad) B_impl->grad += C_impl->grad % A_impl->data;
-                }
-                else if (A_impl->data.size() == 1)
-                {
-                    if (B_impl->requires_grad) B_impl->grad += C_impl->grad * A_impl->data(0, 0);
-                }
-                else if (B_impl->data.size() == 1)
+                const eT *g = C_impl->grad.memptr();
+                const eT *x = A_impl->data.memptr();
+                const eT *y = B_impl->data.memptr();
+
+                if (broadcast::same_shape(A_impl->data, B_impl->data))
                 {
-                    if (A_impl->requires_grad) A_impl->grad += C_impl->grad * B_impl->data(0, 0);
+                    if (A_impl->needs_grad(C_impl))
+                        A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] * y[k]; });
+
+                    if (B_impl->needs_grad(C_impl))
+                        B_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] * x[k]; });
+                    return;
                 }
+
+                const arma::Mat<eT> &G = C_impl->grad;
+                const broadcast::Operand<eT> a(A_impl->data);
+                const broadcast::Operand<eT> b(B_impl->data);
+
+                if (A_impl->needs_grad(C_impl))
+                    A_impl->accumulate_grad_broadcast(G.n_rows, G.n_cols,
+                                                      [&](arma::uword i, arma::uword j) { return G.at(i, j) * b(i, j); });
+
+                if (B_impl->needs_grad(C_impl))
+                    B_impl->accumulate_grad_broadcast(G.n_rows, G.n_cols,
+                                                      [&](arma::uword i, arma::uword j) { return G.at(i, j) * a(i, j); });
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A, B};
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                B_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class ScalarDot_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            double scalar;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            eT scalar;
+            BasicTensorImpl<eT> *C_impl;
 
-            ScalarDot_(Tensor *A, double scalar, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), A_impl(A->get_impl()), scalar(scalar), C_impl(C_impl)
+            ScalarDot_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, eT scalar, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), scalar(scalar), C_impl(C_impl)
             {
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
                 {
-                    A_impl->grad += C_impl->grad * scalar;
+                    const eT *g = C_impl->grad.memptr();
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] * scalar; });
                 }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A};
+                return SavesDerivative;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class Div_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> B_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
-            Tensor *B;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            BasicTensorImpl<eT> *C_impl;
+            // Only the shape of the numerator is needed, so its data is not saved.
+            unsigned long long A_rows;
+            unsigned long long A_cols;
 
-            Div_(Tensor *A, Tensor *B, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), B(B), A_impl(A->get_impl()), B_impl(B->get_impl()), C_impl(C_impl)
+            Div_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                 BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), B_impl(B_impl), C_impl(C_impl), A_rows(A_impl->n_rows),
+                      A_cols(A_impl->n_cols * A_impl->n_slices)
             {
                 set_inputs(A_impl, B_impl);
+                unread_inputs = 1u;
             }
 
+            // d(a / b)/db = -(a / b) / b, so the output stands in for the square of b.
             void backward() override
             {
-                if (A_impl->requires_grad)
-                {
-                    if (B_impl->data.size() == 1)
-                    {
-                        A_impl->grad += C_impl->grad / B_impl->data(0, 0);
-                    }
-                    else
-                    {
-                        A_impl->grad += C_impl->grad % (1.0 / B_impl->data);
-                    }
-                }
+                const eT *g = C_impl->grad.memptr();
+                const eT *y = B_impl->data.memptr();
+                const eT *z = C_impl->data.memptr();
 
-                if (B_impl->requires_grad)
+                if (A_rows == B_impl->data.n_rows && A_cols == B_impl->data.n_cols)
                 {
-                    if (A_impl->data.size() == 1)
-                    {
-                        B_impl->grad -= C_impl->grad % (A_impl->data(0, 0) / arma::square(B_impl->data));
-                    }
-                    else if (B_impl->data.size() == 1)
-                    {
-                        double b_val = B_impl->data(0, 0);
-                        B_impl->grad -= arma::accu(C_impl->grad % (A_impl->data / (b_val * b_val)));
-                    }
-                    else
-                    {
-                        B_impl->grad -= C_impl->grad % (A_impl->data / arma::square(B_impl->data));
-                    }
+                    if (A_impl->needs_grad(C_impl))
+                        A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] / y[k]; });
+
+                    if (B_impl->needs_grad(C_impl))
+                        B_impl->accumulate_grad_elementwise([&](arma::uword k) { return -g[k] * z[k] / y[k]; });
+                    return;
                 }
+
+                const arma::Mat<eT> &G = C_impl->grad;
+                const arma::Mat<eT> &Z = C_impl->data;
+                const broadcast::Operand<eT> b(B_impl->data);
+
+                if (A_impl->needs_grad(C_impl))
+                    A_impl->accumulate_grad_broadcast(G.n_rows, G.n_cols,
+                                                      [&](arma::uword i, arma::uword j) { return G.at(i, j) / b(i, j); });
+
+                if (B_impl->needs_grad(C_impl))
+                    B_impl->accumulate_grad_broadcast(G.n_rows, G.n_cols,
+                                                      [&](arma::uword i, arma::uword j)
+                                                      {
+                                                          return -G.at(i, j) * Z.at(i, j) / b(i, j);
+                                                      });
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A, B};
+                return SavesInputs | SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                B_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class ScalarDiv_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            double scalar;
-            std::shared_ptr<TensorImpl> C_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            eT scalar;
+            BasicTensorImpl<eT> *C_impl;
             bool tensor_numerator;
-            Tensor *A;
 
-            ScalarDiv_(Tensor *A, double scalar, std::shared_ptr<TensorImpl> C_impl, bool tensor_numerator)
-                    : A(A), A_impl(A->get_impl()), scalar(scalar), C_impl(C_impl), tensor_numerator(tensor_numerator)
+            ScalarDiv_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, eT scalar, BasicTensorImpl<eT> *C_impl,
+                       bool tensor_numerator)
+                    : A_impl(A_impl), scalar(scalar), C_impl(C_impl), tensor_numerator(tensor_numerator)
             {
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
                 {
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *x = A_impl->data.memptr();
+                    const eT *z = C_impl->data.memptr();
+
                     if (tensor_numerator)
-                    {
-                        A_impl->grad += C_impl->grad * (1.0 / scalar);
-                    }
+                        A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] / scalar; });
                     else
-                    {
-                        A_impl->grad -= C_impl->grad % (scalar / arma::square(A_impl->data));
-                    }
+                        A_impl->accumulate_grad_elementwise([&](arma::uword k) { return -g[k] * z[k] / x[k]; });
                 }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A};
+                return tensor_numerator ? SavesDerivative : SavesInputs | SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class Sum_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            unsigned long long dim;
-            arma::uvec orig_dims;
-            Tensor *A;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            reduction::Axes axes;
 
-            Sum_(Tensor *A, std::shared_ptr<TensorImpl> C_impl, unsigned long long dim)
-                    : A(A), A_impl(A->get_impl()), C_impl(C_impl), dim(dim)
+            Sum_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl, reduction::Axes axes)
+                    : A_impl(A_impl), C_impl(C_impl), axes(axes)
             {
-                orig_dims = {A_impl->n_rows, A_impl->n_cols};
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
                 {
-                    if (dim == 0)
-                    {
-                        arma::mat ones_mat = arma::ones(orig_dims[0], 1);
-                        A_impl->grad += ones_mat * C_impl->grad;
-                    }
-                    else if (dim == 1)
-                    {
-                        arma::mat ones_mat = arma::ones(1, orig_dims[1]);
-                        A_impl->grad += C_impl->grad * ones_mat;
-                    }
+                    A_impl->update_grad([this](arma::Mat<eT> &grad, bool overwrite)
+                                        { reduction::spread(grad, overwrite, C_impl->grad, axes, eT(1)); });
                 }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
+            }
+
+            void release_saved() override
             {
-                return {A};
+                A_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class Mean_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            unsigned long long dim;
-            arma::uvec orig_dims;
-            Tensor *A;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            reduction::Axes axes;
+            eT scale;
 
+            Mean_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl, reduction::Axes axes)
+                    : A_impl(A_impl), C_impl(C_impl), axes(axes)
+            {
+                scale = eT(1) / static_cast<eT>(reduction::count(A_impl->data.n_rows, A_impl->data.n_cols, axes));
+                set_inputs(A_impl);
+            }
 
-            Mean_(Tensor *A, std::shared_ptr<TensorImpl> C_impl, unsigned long long dim)
-                    : A(A), A_impl(A->get_impl()), C_impl(C_impl), dim(dim)
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    A_impl->update_grad([this](arma::Mat<eT> &grad, bool overwrite)
+                                        { reduction::spread(grad, overwrite, C_impl->grad, axes, scale); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesDerivative;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // Backward of max and min: the gradient of each output goes to the input element recorded in index.
+        template<typename eT>
+        class Extremum_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            arma::uvec index;
+
+            Extremum_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl, arma::uvec &&index)
+                    : A_impl(A_impl), C_impl(C_impl), index(std::move(index))
             {
-                orig_dims = {A_impl->n_rows, A_impl->n_cols};
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
                 {
-                    if (dim == 0)
-                    {
-                        arma::mat ones_mat = arma::ones(orig_dims[0], 1);
-                        A_impl->grad += ones_mat * C_impl->grad / static_cast<double>(orig_dims[0]);
-                    }
-                    else if (dim == 1)
-                    {
-                        arma::mat ones_mat = arma::ones(1, orig_dims[1]);
-                        A_impl->grad += C_impl->grad * ones_mat / static_cast<double>(orig_dims[1]);
-                    }
+                    A_impl->update_grad([this](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            if (overwrite) grad.zeros();
+
+                                            eT *d = grad.memptr();
+                                            const eT *g = C_impl->grad.memptr();
+
+                                            for (arma::uword r = 0; r < index.n_elem; ++r)
+                                            {
+                                                d[index[r]] += g[r];
+                                            }
+                                        });
                 }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A};
+                return SavesDerivative;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                index.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
+        class LogSumExp_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            reduction::Axes axes;
+
+            LogSumExp_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl,
+                       reduction::Axes axes)
+                    : A_impl(A_impl), C_impl(C_impl), axes(axes)
+            {
+                set_inputs(A_impl);
+            }
+
+            // d/dx logsumexp(x) = exp(x - logsumexp(x)), read off the saved output instead of a stored softmax. As in
+            // the forward pass, a slice whose result is not finite (all -inf, or holding +inf) is left out of the
+            // subtraction, where inf - inf would turn its gradient into NaN; it gets none.
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    A_impl->update_grad([this](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            eT *d = grad.memptr();
+                                            const eT *x = A_impl->data.memptr();
+                                            const eT *y = C_impl->data.memptr();
+                                            const eT *g = C_impl->grad.memptr();
+
+                                            reduction::for_each(grad.n_rows, grad.n_cols, axes,
+                                                                [&](arma::uword k, arma::uword r)
+                                                                {
+                                                                    const eT v = std::isfinite(y[r])
+                                                                                 ? g[r] * std::exp(x[k] - y[r])
+                                                                                 : eT(0);
+                                                                    d[k] = overwrite ? v : d[k] + v;
+                                                                });
+                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs | SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
 
+        template<typename eT>
         class Exp_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
 
-            Exp_(Tensor *A, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), A_impl(A->get_impl()), C_impl(C_impl)
+            Exp_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
             {
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
                 {
-                    A_impl->grad += C_impl->grad % arma::exp(A_impl->data);
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *z = C_impl->data.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] * z[k]; });
                 }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A};
+                return SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
             }
         };
 
 
+        template<typename eT>
         class Log_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
 
-            Log_(Tensor *A, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), A_impl(A->get_impl()), C_impl(C_impl)
+            Log_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
             {
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
                 {
-                    A_impl->grad += C_impl->grad % (1.0 / A_impl->data);
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *x = A_impl->data.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] / x[k]; });
                 }
             }
 
-            std::vector<Tensor *> parents() override
+            unsigned saved_values() const override
             {
-                return {A};
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
             }
         };
 
+        template<typename eT>
         class Abs_ : public Function
         {
         public:
-            std::shared_ptr<TensorImpl> A_impl;
-            std::shared_ptr<TensorImpl> C_impl;
-            Tensor *A;
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+
+            Abs_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *x = A_impl->data.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k)
+                                                        {
+                                                            return x[k] > eT(0) ? g[k] : (x[k] < eT(0) ? -g[k] : eT(0));
+                                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // Keeps one bit per element, where the input was positive, instead of the input itself. A_impl is only the
+        // gradient edge: nothing registers it as read, so its data is released once no handle needs it.
+        template<typename eT>
+        class ReLU_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            kernels::BitMask mask;
+
+            ReLU_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl,
+                  kernels::BitMask &&mask)
+                    : A_impl(A_impl), C_impl(C_impl), mask(std::move(mask))
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k) { return mask.test(k) ? g[k] : eT(0); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesDerivative;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                mask.reset();
+                Function::release_saved();
+            }
+        };
+
+        // sigmoid'(x) = y * (1 - y), read off the output; the input's data is not held (see ReLU_).
+        template<typename eT>
+        class Sigmoid_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+
+            Sigmoid_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *y = C_impl->data.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k) { return g[k] * y[k] * (eT(1) - y[k]); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // tanh'(x) = 1 - y^2, read off the output; the input's data is not held (see ReLU_).
+        template<typename eT>
+        class Tanh_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+
+            Tanh_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *y = C_impl->data.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k)
+                                                        { return g[k] * activation::tanh_derivative(y[k]); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // GELU's derivative has no closed form in its output, so this one reads the input.
+        template<typename eT>
+        class GELU_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+
+            GELU_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+                    const eT *x = A_impl->data.memptr();
+
+                    A_impl->accumulate_grad_elementwise([&](arma::uword k)
+                                                        { return g[k] * activation::gelu_derivative(x[k]); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        template<typename eT>
+        class Transpose_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+
+            Transpose_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const arma::Mat<eT> &g = C_impl->grad;
+
+                    A_impl->update_grad([&g](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            if (overwrite)
+                                                grad = g.t();
+                                            else
+                                                grad += g.t();
+                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // A block of rows or columns: the output gradient lands in the same block of the input's gradient.
+        template<typename eT>
+        class Slice_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            arma::uword first_row;
+            arma::uword first_col;
+
+            Slice_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl, arma::uword first_row,
+                   arma::uword first_col)
+                    : A_impl(A_impl), C_impl(C_impl), first_row(first_row), first_col(first_col)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const arma::Mat<eT> &g = C_impl->grad;
+
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        { kernels::scatter(grad, overwrite, g, first_row, first_col); });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // Same elements in the same order, so the gradient is added back element by element.
+        template<typename eT>
+        class Reshape_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
 
-            Abs_(Tensor *A, std::shared_ptr<TensorImpl> C_impl)
-                    : A(A), A_impl(A->get_impl()), C_impl(C_impl)
+            Reshape_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
             {
                 set_inputs(A_impl);
             }
 
             void backward() override
             {
-                if (A_impl->requires_grad)
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+                    A_impl->accumulate_grad_elementwise([g](arma::uword k) { return g[k]; });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // op(A_k) * op(B_k) for every slice k, one gemm per slice. An operand with a single slice is shared by the
+        // whole batch and its gradient sums the contributions of every slice.
+        template<typename eT>
+        class BatchMatMul_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            BasicTensorImpl<eT> *C_impl;
+            bool trans_A;
+            bool trans_B;
+
+            BatchMatMul_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl,
+                         const std::shared_ptr<BasicTensorImpl<eT>> &B_impl, BasicTensorImpl<eT> *C_impl,
+                         bool trans_A = false, bool trans_B = false)
+                    : A_impl(A_impl), B_impl(B_impl), C_impl(C_impl), trans_A(trans_A), trans_B(trans_B)
+            {
+                set_inputs(A_impl, B_impl);
+            }
+
+            // Per slice, the gradients of MatMul_.
+            void backward() override
+            {
+                const arma::uword n_slices = C_impl->n_slices;
+                const arma::uword A_slices = A_impl->n_slices;
+                const arma::uword B_slices = B_impl->n_slices;
+
+                if (A_impl->needs_grad(C_impl))
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            for (arma::uword k = 0; k < n_slices; ++k)
+                                            {
+                                                arma::Mat<eT> dst = kernels::slice(grad, A_slices, k);
+                                                const arma::Mat<eT> g = kernels::slice(C_impl->grad, n_slices, k);
+                                                const arma::Mat<eT> b = kernels::slice(B_impl->data, B_slices, k);
+                                                const bool first = overwrite && (A_slices > 1 || k == 0);
+
+                                                if (trans_A)
+                                                    kernels::gemm(dst, first, b, trans_B, g, true);
+                                                else
+                                                    kernels::gemm(dst, first, g, false, b, !trans_B);
+                                            }
+                                        });
+
+                if (B_impl->needs_grad(C_impl))
+                    B_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            for (arma::uword k = 0; k < n_slices; ++k)
+                                            {
+                                                arma::Mat<eT> dst = kernels::slice(grad, B_slices, k);
+                                                const arma::Mat<eT> g = kernels::slice(C_impl->grad, n_slices, k);
+                                                const arma::Mat<eT> a = kernels::slice(A_impl->data, A_slices, k);
+                                                const bool first = overwrite && (B_slices > 1 || k == 0);
+
+                                                if (trans_B)
+                                                    kernels::gemm(dst, first, g, true, a, trans_A);
+                                                else
+                                                    kernels::gemm(dst, first, a, !trans_A, g, false);
+                                            }
+                                        });
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                B_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // Size-1 rows, columns or slices repeated to a larger shape; the gradient is summed back over the copies.
+        template<typename eT>
+        class Expand_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+
+            Expand_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl)
+                    : A_impl(A_impl), C_impl(C_impl)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const eT *g = C_impl->grad.memptr();
+
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            if (overwrite) grad.zeros();
+                                            eT *d = grad.memptr();
+
+                                            for_each_source(*A_impl, *C_impl, [&](arma::uword k, arma::uword src)
+                                            { d[src] += g[k]; });
+                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+
+            // Calls f(k, src) for every element k of C, src being the element of A it copies.
+            template<typename F>
+            static void for_each_source(const TensorImplBase &A, const TensorImplBase &C, F f)
+            {
+                const arma::uword row_step = A.n_rows == 1 ? 0 : 1;
+                const arma::uword col_step = A.n_cols == 1 ? 0 : A.n_rows;
+                const arma::uword slice_step = A.n_slices == 1 ? 0 : A.n_rows * A.n_cols;
+                arma::uword k = 0;
+
+                for (arma::uword s = 0; s < C.n_slices; ++s)
+                    for (arma::uword j = 0; j < C.n_cols; ++j)
+                        for (arma::uword i = 0; i < C.n_rows; ++i) f(k++, i * row_step + j * col_step + s * slice_step);
+            }
+        };
+
+        // Checks shared by the in-place operators, other being null for unary and scalar ones. Returns whether the
+        // operation has to be recorded. A leaf that requires grad has no history to chain its old value to, and a
+        // view would need its base's history rewritten, so neither can be modified in place while grad is recorded.
+        template<typename eT>
+        bool prepare_in_place(const BasicTensorImpl<eT> &A, const BasicTensorImpl<eT> *other, const char *op)
+        {
+            if (other && (other->n_slices != A.n_slices || (A.n_slices > 1 && other->n_cols != A.n_cols)))
+            {
+                throw std::runtime_error(std::string(op) + " requires the right-hand side to have the tensor's slices "
+                                                           "and columns; expand() it first");
+            }
+
+            if (other && (broadcast::extent(A.data.n_rows, other->data.n_rows, op) != A.data.n_rows ||
+                          broadcast::extent(A.data.n_cols, other->data.n_cols, op) != A.data.n_cols))
+            {
+                throw std::runtime_error(std::string(op) + " requires the right-hand side to broadcast to the "
+                                                           "tensor's shape");
+            }
+
+            if (!GradMode::is_enabled() || !(A.requires_grad || (other && other->requires_grad)))
+            {
+                return false;
+            }
+
+            if (A.requires_grad && !A.grad_fn)
+            {
+                throw std::runtime_error(std::string(op) + " cannot modify a leaf tensor that requires grad while "
+                                                           "grad is recorded");
+            }
+
+            if (A.base)
+            {
+                throw std::runtime_error(std::string(op) + " cannot be recorded on a view");
+            }
+
+            if (other && other->version_counter == A.version_counter)
+            {
+                throw std::runtime_error(std::string(op) + " cannot be recorded when both operands share storage");
+            }
+
+            return true;
+        }
+
+        // A = f(A, B) element by element, B broadcast to A's shape. B is read from a copy when it shares A's storage.
+        template<typename eT, typename F>
+        void update_in_place(BasicTensorImpl<eT> &A, const BasicTensorImpl<eT> &B, F f)
+        {
+            const arma::Mat<eT> copy = B.version_counter == A.version_counter ? B.data : arma::Mat<eT>();
+            const broadcast::Operand<eT> b(B.version_counter == A.version_counter ? copy : B.data);
+            arma::Mat<eT> &a = A.data;
+
+            for (arma::uword j = 0; j < a.n_cols; ++j)
+                for (arma::uword i = 0; i < a.n_rows; ++i) a.at(i, j) = f(a.at(i, j), b(i, j));
+        }
+
+        // Base of the nodes recorded by in-place operators. The modified tensor keeps its identity, so the node that
+        // produced its old value is chained behind the new one: backward() rewrites C_impl->grad from the gradient
+        // of the new value into that of the old one, then runs the previous node on it.
+        template<typename eT>
+        class InPlace_ : public Function
+        {
+        public:
+            std::shared_ptr<Function> prev_fn;
+            BasicTensorImpl<eT> *C_impl;
+            // prev_fn's inputs come first, so the engine reaches them through this node.
+            std::size_t n_prev_inputs = 0;
+
+            explicit InPlace_(BasicTensorImpl<eT> *C_impl) : prev_fn(C_impl->grad_fn), C_impl(C_impl)
+            {
+                if (prev_fn)
+                {
+                    for (const auto &impl: prev_fn->input_tensor_impls)
+                    {
+                        set_inputs(impl);
+                    }
+                    n_prev_inputs = input_tensor_impls.size();
+                }
+
+                output_version = *C_impl->version_counter;
+            }
+
+            // prev_fn checks its own inputs before it runs.
+            void check_versions(const TensorImplBase &output) const override
+            {
+                Function::check_versions(output, n_prev_inputs);
+            }
+
+            void backward() override
+            {
+                propagate(prev_fn != nullptr);
+
+                if (prev_fn)
                 {
-                    arma::mat sign_matrix = arma::sign(A_impl->data);
-                    sign_matrix.elem(arma::find(A_impl->data == 0)).zeros();
+                    prev_fn->check_versions(*C_impl);
+                    prev_fn->backward();
+                }
+            }
+
+            void release_saved() override
+            {
+                if (prev_fn) prev_fn->release_saved();
+                Function::release_saved();
+            }
+
+        protected:
+            // Adds the contributions to the other operand and, with rewrite, turns C_impl->grad into the gradient
+            // with respect to C's value before the operation.
+            virtual void propagate(bool rewrite) = 0;
+        };
+
+        // C (+/-)= B, B broadcast to C's shape.
+        template<typename eT>
+        class AddInPlace_ : public InPlace_<eT>
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            eT sign;
+
+            AddInPlace_(BasicTensorImpl<eT> *C_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl, eT sign)
+                    : InPlace_<eT>(C_impl), B_impl(B_impl), sign(sign)
+            {
+                this->set_inputs(B_impl);
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesNothing;
+            }
+
+            void release_saved() override
+            {
+                B_impl.reset();
+                InPlace_<eT>::release_saved();
+            }
+
+        protected:
+            void propagate(bool) override
+            {
+                const arma::Mat<eT> &g = this->C_impl->grad;
+
+                if (B_impl->needs_grad(this->C_impl))
+                    B_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols,
+                                                      [&](arma::uword i, arma::uword j) { return sign * g.at(i, j); });
+            }
+        };
 
-                    A_impl->grad += C_impl->grad % sign_matrix;
+        // C *= B. C's old value is only kept when B needs its gradient.
+        template<typename eT>
+        class MulInPlace_ : public InPlace_<eT>
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            arma::Mat<eT> original;
+
+            MulInPlace_(BasicTensorImpl<eT> *C_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                        arma::Mat<eT> &&original)
+                    : InPlace_<eT>(C_impl), B_impl(B_impl), original(std::move(original))
+            {
+                this->set_inputs(B_impl);
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                B_impl.reset();
+                original.reset();
+                InPlace_<eT>::release_saved();
+            }
+
+        protected:
+            void propagate(bool rewrite) override
+            {
+                arma::Mat<eT> &g = this->C_impl->grad;
+                const broadcast::Operand<eT> b(B_impl->data);
+
+                if (B_impl->needs_grad(this->C_impl))
+                {
+                    const broadcast::Operand<eT> a(original);
+                    B_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols, [&](arma::uword i, arma::uword j)
+                    { return g.at(i, j) * a(i, j); });
                 }
+
+                if (rewrite)
+                {
+                    for (arma::uword j = 0; j < g.n_cols; ++j)
+                        for (arma::uword i = 0; i < g.n_rows; ++i) g.at(i, j) *= b(i, j);
+                }
+            }
+        };
+
+        // C /= B. Like MulInPlace_, C's old value is only kept when B needs its gradient.
+        template<typename eT>
+        class DivInPlace_ : public InPlace_<eT>
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> B_impl;
+            arma::Mat<eT> original;
+
+            DivInPlace_(BasicTensorImpl<eT> *C_impl, const std::shared_ptr<BasicTensorImpl<eT>> &B_impl,
+                        arma::Mat<eT> &&original)
+                    : InPlace_<eT>(C_impl), B_impl(B_impl), original(std::move(original))
+            {
+                this->set_inputs(B_impl);
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                B_impl.reset();
+                original.reset();
+                InPlace_<eT>::release_saved();
             }
 
-            std::vector<Tensor *> parents() override
+        protected:
+            void propagate(bool rewrite) override
+            {
+                arma::Mat<eT> &g = this->C_impl->grad;
+                const broadcast::Operand<eT> b(B_impl->data);
+
+                if (B_impl->needs_grad(this->C_impl))
+                {
+                    const broadcast::Operand<eT> a(original);
+                    B_impl->accumulate_grad_broadcast(g.n_rows, g.n_cols, [&](arma::uword i, arma::uword j)
+                    { return -g.at(i, j) * a(i, j) / (b(i, j) * b(i, j)); });
+                }
+
+                if (rewrite)
+                {
+                    for (arma::uword j = 0; j < g.n_cols; ++j)
+                        for (arma::uword i = 0; i < g.n_rows; ++i) g.at(i, j) /= b(i, j);
+                }
+            }
+        };
+
+        // C *= scalar; division by a scalar records its reciprocal.
+        template<typename eT>
+        class ScalarMulInPlace_ : public InPlace_<eT>
+        {
+        public:
+            eT scalar;
+
+            ScalarMulInPlace_(BasicTensorImpl<eT> *C_impl, eT scalar) : InPlace_<eT>(C_impl), scalar(scalar)
+            {}
+
+            unsigned saved_values() const override
             {
-                return {A};
+                return SavesDerivative;
+            }
+
+        protected:
+            void propagate(bool rewrite) override
+            {
+                if (rewrite) this->C_impl->grad *= scalar;
+            }
+        };
+
+        // C = exp(C): the derivative is the new value.
+        template<typename eT>
+        class ExpInPlace_ : public InPlace_<eT>
+        {
+        public:
+            explicit ExpInPlace_(BasicTensorImpl<eT> *C_impl) : InPlace_<eT>(C_impl)
+            {}
+
+            unsigned saved_values() const override
+            {
+                return SavesOutput;
+            }
+
+        protected:
+            void propagate(bool rewrite) override
+            {
+                if (rewrite)
+                {
+                    const eT *z = this->C_impl->data.memptr();
+                    eT *g = this->C_impl->grad.memptr();
+
+                    for (arma::uword k = 0; k < this->C_impl->grad.n_elem; ++k) g[k] *= z[k];
+                }
+            }
+        };
+
+        // C = log(C): 1 / x is exp(-new value), so the old value need not be kept.
+        template<typename eT>
+        class LogInPlace_ : public InPlace_<eT>
+        {
+        public:
+            explicit LogInPlace_(BasicTensorImpl<eT> *C_impl) : InPlace_<eT>(C_impl)
+            {}
+
+            unsigned saved_values() const override
+            {
+                return SavesOutput;
+            }
+
+        protected:
+            void propagate(bool rewrite) override
+            {
+                if (rewrite)
+                {
+                    const eT *z = this->C_impl->data.memptr();
+                    eT *g = this->C_impl->grad.memptr();
+
+                    for (arma::uword k = 0; k < this->C_impl->grad.n_elem; ++k) g[k] *= std::exp(-z[k]);
+                }
             }
         };
     }
@@ -1,96 +1,391 @@
 #ifndef MALPHAX_BASE_HPP
 #define MALPHAX_BASE_HPP
 
+#include "memory.hpp"
 #include <armadillo>
+#include <initializer_list>
 #include <memory>
 #include <vector>
 #include <string>
+#include <utility>
 
 namespace Malphax
 {
-    class TensorImpl;
+    class TensorImplBase;
 
-    class Tensor;
+    template<typename eT>
+    class BasicTensorImpl;
+
+    template<typename eT>
+    class BasicTensor;
+
+    using TensorImpl = BasicTensorImpl<double>;
+
+    using FloatTensorImpl = BasicTensorImpl<float>;
+
+    using Tensor = BasicTensor<double>;
+
+    using FloatTensor = BasicTensor<float>;
 
     namespace autograd
     {
+        // Forward values a Function reads back in backward besides its output gradient. Where the derivative can be
+        // written in terms of the output (exp) or a small precomputed value (a scalar, argmax indices), that is what
+        // is kept rather than recomputing from the input. This decides what stays in memory: a tensor's data is
+        // released once no handle refers to it unless a node declaring SavesInputs consumes it or its own node
+        // declares SavesOutput, while the graph edges keep only what the gradient needs.
+        enum SavedValues : unsigned
+        {
+            SavesNothing = 0,
+            SavesInputs = 1u << 0,
+            SavesOutput = 1u << 1,
+            SavesDerivative = 1u << 2
+        };
+
+        // A Function is owned through the grad_fn of the TensorImpl it produced, so subclasses refer back to that
+        // output with a plain pointer; owning it would make every node a reference cycle.
         class Function
         {
         public:
             virtual void backward() = 0;
 
-            virtual std::vector<Tensor *> parents() = 0;
+            virtual unsigned saved_values() const = 0;
+
+            typedef std::vector<std::shared_ptr<TensorImplBase>, memory::StdAllocator<std::shared_ptr<TensorImplBase>>>
+                    Edges;
+            typedef std::vector<unsigned long long, memory::StdAllocator<unsigned long long>> Versions;
+
+            // Both start out as the lists a node rebuilt in this one's place handed over; see donate_edges().
+            Edges input_tensor_impls{std::move(spare_edges().first)};
+            // Version of each input, and of the output, when the node was recorded; see check_versions().
+            Versions input_versions{std::move(spare_edges().second)};
+            unsigned long long output_version = 0;
+            // Set on nodes a capture rebuilds in place: release_saved() empties the edge lists without freeing them.
+            bool recycle_edges = false;
+
+            void set_inputs(const std::shared_ptr<TensorImplBase> &A_impl, const std::shared_ptr<TensorImplBase> &B_impl);
 
-            std::vector<std::shared_ptr<TensorImpl>> input_tensor_impls;
+            void set_inputs(const std::shared_ptr<TensorImplBase> &A_impl);
 
-            void set_inputs(const std::shared_ptr<TensorImpl> &A_impl, const std::shared_ptr<TensorImpl> &B_impl)
+            // Throws if a value this node reads back in backward, or the history behind one of its inputs, was
+            // changed by an in-place operator after the node was recorded.
+            virtual void check_versions(const TensorImplBase &output) const
             {
-                input_tensor_impls.push_back(A_impl);
-                input_tensor_impls.push_back(B_impl);
+                check_versions(output, 0);
             }
 
-            void set_inputs(const std::shared_ptr<TensorImpl> &A_impl)
+            // Registers this node as reading the data of its inputs when it saves them (SavesInputs), so that data
+            // outlives every tensor handle to it for as long as the node needs it, and no longer.
+            void hold_saved_inputs();
+
+            virtual void release_saved()
+            {
+                drop_saved_inputs();
+                input_tensor_impls.clear();
+                input_versions.clear();
+
+                if (!recycle_edges)
+                {
+                    input_tensor_impls.shrink_to_fit();
+                    input_versions.shrink_to_fit();
+                }
+
+                released = true;
+            }
+
+            // Empties the edge lists, keeping their capacity, and leaves them to the next Function constructed on
+            // this thread. A capture calls this right before rebuilding the node in place.
+            void donate_edges()
             {
-                input_tensor_impls.push_back(A_impl);
+                drop_saved_inputs();
+                input_tensor_impls.clear();
+                input_versions.clear();
+                spare_edges().first = std::move(input_tensor_impls);
+                spare_edges().second = std::move(input_versions);
             }
 
-            virtual ~Function() = default;
+            bool is_released() const
+            {
+                return released;
+            }
+
+            virtual ~Function();
+
+            // Non-zero for nodes built while a checkpointed segment is being recomputed; backward through the
+            // segment only walks nodes carrying its id.
+            const unsigned long long segment = recording_segment();
+
+            static unsigned long long &recording_segment()
+            {
+                static thread_local unsigned long long id = 0;
+                return id;
+            }
+
+        protected:
+            // Only checks the inputs from first_input on.
+            void check_versions(const TensorImplBase &output, std::size_t first_input) const;
+
+            // Inputs, by position, whose data backward never reads although the node saves its inputs; they are
+            // neither held for the node nor version checked. Only the first 64 positions can be listed.
+            unsigned long long unread_inputs = 0;
+
+            bool reads_input(std::size_t i) const
+            {
+                return i >= 64 || !((unread_inputs >> i) & 1u);
+            }
+
+        private:
+            bool released = false;
+            bool holds_inputs = false;
+
+            void drop_saved_inputs();
+
+            static std::pair<Edges, Versions> &spare_edges()
+            {
+                static thread_local std::pair<Edges, Versions> spare;
+                return spare;
+            }
         };
 
+        template<typename eT>
         class Add_;
 
+        template<typename eT>
         class Sub_;
 
+        template<typename eT>
         class MatMul_;
 
+        template<typename eT>
         class Dot_;
 
+        template<typename eT>
         class ScalarDot_;
 
+        template<typename eT>
         class Div_;
 
+        template<typename eT>
         class ScalarDiv_;
 
+        template<typename eT>
         class Sum_;
 
+        template<typename eT>
         class Mean_;
 
+        template<typename eT>
+        class Extremum_;
+
+        template<typename eT>
+        class LogSumExp_;
+
+        template<typename eT>
         class Exp_;
 
+        template<typename eT>
         class Log_;
 
+        template<typename eT>
         class Abs_;
+
+        template<typename eT>
+        class ReLU_;
+
+        template<typename eT>
+        class Sigmoid_;
+
+        template<typename eT>
+        class Tanh_;
+
+        template<typename eT>
+        class GELU_;
+
+        template<typename eT>
+        class Transpose_;
+
+        template<typename eT>
+        class Slice_;
+
+        template<typename eT>
+        class Reshape_;
+
+        template<typename eT>
+        class BatchMatMul_;
+
+        template<typename eT>
+        class Expand_;
+
+        template<typename eT>
+        class AddInPlace_;
+
+        template<typename eT>
+        class MulInPlace_;
+
+        template<typename eT>
+        class DivInPlace_;
+
+        template<typename eT>
+        class ScalarMulInPlace_;
+
+        template<typename eT>
+        class ExpInPlace_;
+
+        template<typename eT>
+        class LogInPlace_;
     }
 
-    Tensor operator+(const Tensor &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> operator+(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator-(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator*(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator*(const BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator*(const typename BasicTensor<eT>::elem_type &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator/(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator/(const BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B);
+
+    template<typename eT>
+    BasicTensor<eT> operator/(const typename BasicTensor<eT>::elem_type &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> matmul(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> matmul(const BasicTensor<eT> &A, const BasicTensor<eT> &B, bool trans_A, bool trans_B);
+
+    template<typename eT>
+    BasicTensor<eT> dot(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
+
+    template<typename eT>
+    BasicTensor<eT> sum(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> sum(const BasicTensor<eT> &A, unsigned long long dim);
+
+    template<typename eT>
+    BasicTensor<eT> sum(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims);
+
+    template<typename eT>
+    BasicTensor<eT> mean(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> mean(const BasicTensor<eT> &A, unsigned long long dim);
+
+    template<typename eT>
+    BasicTensor<eT> mean(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims);
+
+    template<typename eT>
+    BasicTensor<eT> max(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> max(const BasicTensor<eT> &A, unsigned long long dim);
+
+    template<typename eT>
+    BasicTensor<eT> max(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims);
+
+    template<typename eT>
+    BasicTensor<eT> min(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> min(const BasicTensor<eT> &A, unsigned long long dim);
+
+    template<typename eT>
+    BasicTensor<eT> min(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims);
+
+    template<typename eT>
+    BasicTensor<eT> logsumexp(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> logsumexp(const BasicTensor<eT> &A, unsigned long long dim);
+
+    template<typename eT>
+    BasicTensor<eT> logsumexp(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims);
+
+    template<typename eT>
+    BasicTensor<eT> exp(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> log(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> abs(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> relu(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> sigmoid(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> tanh(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> gelu(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> t(const BasicTensor<eT> &A);
+
+    template<typename eT>
+    BasicTensor<eT> rows(const BasicTensor<eT> &A, unsigned long long first_row, unsigned long long last_row);
+
+    template<typename eT>
+    BasicTensor<eT> cols(const BasicTensor<eT> &A, unsigned long long first_col, unsigned long long last_col);
 
-    Tensor operator-(const Tensor &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> reshape(const BasicTensor<eT> &A, unsigned long long n_rows, unsigned long long n_cols);
 
-    Tensor operator*(const Tensor &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> reshape(const BasicTensor<eT> &A, unsigned long long n_rows, unsigned long long n_cols,
+                            unsigned long long n_slices);
 
-    Tensor operator*(const Tensor &A, const double &B);
+    template<typename eT>
+    BasicTensor<eT> slices(const BasicTensor<eT> &A, unsigned long long first_slice, unsigned long long last_slice);
 
-    Tensor operator*(const double &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> expand(const BasicTensor<eT> &A, unsigned long long n_rows, unsigned long long n_cols,
+                           unsigned long long n_slices);
 
-    Tensor operator/(const Tensor &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> bmm(const BasicTensor<eT> &A, const BasicTensor<eT> &B);
 
-    Tensor operator/(const Tensor &A, const double &B);
+    template<typename eT>
+    BasicTensor<eT> bmm(const BasicTensor<eT> &A, const BasicTensor<eT> &B, bool trans_A, bool trans_B);
 
-    Tensor operator/(const double &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> &add_(BasicTensor<eT> &A, const BasicTensor<eT> &B);
 
-    Tensor matmul(const Tensor &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> &sub_(BasicTensor<eT> &A, const BasicTensor<eT> &B);
 
-    Tensor dot(const Tensor &A, const Tensor &B);
+    template<typename eT>
+    BasicTensor<eT> &mul_(BasicTensor<eT> &A, const BasicTensor<eT> &B);
 
-    Tensor sum(const Tensor &A, unsigned long long dim);
+    template<typename eT>
+    BasicTensor<eT> &mul_(BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B);
 
-    Tensor mean(const Tensor &A, unsigned long long dim);
+    template<typename eT>
+    BasicTensor<eT> &div_(BasicTensor<eT> &A, const BasicTensor<eT> &B);
 
-    Tensor exp(const Tensor &A);
+    template<typename eT>
+    BasicTensor<eT> &div_(BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B);
 
-    Tensor log(const Tensor &A);
+    template<typename eT>
+    BasicTensor<eT> &exp_(BasicTensor<eT> &A);
 
-    Tensor abs(const Tensor &A);
+    template<typename eT>
+    BasicTensor<eT> &log_(BasicTensor<eT> &A);
 
 }
 
@@ -0,0 +1,94 @@
+#ifndef BROADCAST_HPP
+#define BROADCAST_HPP
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <armadillo>
+
+namespace Malphax
+{
+    // NumPy broadcasting for matrices: along each axis the sizes must match or one of them must be 1. Operands are
+    // never expanded; a size-1 axis is read with a zero step and its gradient is summed back along that axis.
+    namespace broadcast
+    {
+        inline arma::uword extent(arma::uword a, arma::uword b, const char *op)
+        {
+            if (a == b || b == 1) return a;
+            if (a == 1) return b;
+
+            throw std::runtime_error(std::string(op) + " requires tensors of broadcastable shapes");
+        }
+
+        template<typename eT>
+        bool same_shape(const arma::Mat<eT> &A, const arma::Mat<eT> &B)
+        {
+            return A.n_rows == B.n_rows && A.n_cols == B.n_cols;
+        }
+
+        template<typename eT>
+        class Operand
+        {
+        public:
+            explicit Operand(const arma::Mat<eT> &M)
+                    : mem(M.memptr()), row_step(M.n_rows == 1 ? 0 : 1), col_step(M.n_cols == 1 ? 0 : M.n_rows)
+            {}
+
+            eT operator()(arma::uword i, arma::uword j) const
+            {
+                return mem[i * row_step + j * col_step];
+            }
+
+        private:
+            const eT *mem;
+            arma::uword row_step;
+            arma::uword col_step;
+        };
+
+        // Rows and columns of the broadcast shape of A and B.
+        template<typename eT>
+        std::pair<arma::uword, arma::uword> shape(const arma::Mat<eT> &A, const arma::Mat<eT> &B, const char *op)
+        {
+            return {extent(A.n_rows, B.n_rows, op), extent(A.n_cols, B.n_cols, op)};
+        }
+
+        // out(i, j) = f(A(i, j), B(i, j)) in one pass, out already having the broadcast shape (see shape()).
+        template<typename eT, typename F>
+        void apply(arma::Mat<eT> &out, const arma::Mat<eT> &A, const arma::Mat<eT> &B, F f)
+        {
+            const Operand<eT> a(A);
+            const Operand<eT> b(B);
+            eT *o = out.memptr();
+
+            for (arma::uword j = 0; j < out.n_cols; ++j)
+            {
+                for (arma::uword i = 0; i < out.n_rows; ++i)
+                {
+                    *o++ = f(a(i, j), b(i, j));
+                }
+            }
+        }
+
+        // Adjoint of Operand: adds f(i, j) over the n_rows x n_cols broadcast shape into dst, which has the operand's
+        // shape and is zeroed first when overwrite.
+        template<typename eT, typename F>
+        void reduce(arma::Mat<eT> &dst, bool overwrite, arma::uword n_rows, arma::uword n_cols, F f)
+        {
+            const arma::uword row_step = dst.n_rows == 1 ? 0 : 1;
+            const arma::uword col_step = dst.n_cols == 1 ? 0 : dst.n_rows;
+
+            if (overwrite) dst.zeros();
+            eT *d = dst.memptr();
+
+            for (arma::uword j = 0; j < n_cols; ++j)
+            {
+                for (arma::uword i = 0; i < n_rows; ++i)
+                {
+                    d[i * row_step + j * col_step] += f(i, j);
+                }
+            }
+        }
+    }
+}
+
+#endif // BROADCAST_HPP
\ No newline at end of file
@@ -0,0 +1,265 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "base.hpp"
+#include "tensor_impl.hpp"
+#include "engine.hpp"
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        // Results and Functions that operators create while a graph is captured. Capturing keeps each one in
+        // creation order; replaying hands the same objects back in that order, so every operator recomputes into
+        // the result buffer it used last time and its node is rebuilt where the previous one lived. Backward walks
+        // the records like a tape instead of searching the graph, unless an in-place operator has made creation
+        // order non-topological. Gradient buffers are kept across replays as well (see recycle_grad).
+        class Capture
+        {
+        public:
+            std::vector<std::shared_ptr<TensorImplBase>> records;
+            std::vector<std::shared_ptr<Function>> nodes;
+
+            Capture() = default;
+
+            Capture(const Capture &) = delete;
+
+            Capture &operator=(const Capture &) = delete;
+
+            template<typename eT>
+            std::shared_ptr<BasicTensorImpl<eT>> result()
+            {
+                if (!replaying)
+                {
+                    return record(std::allocate_shared<BasicTensorImpl<eT>>(
+                            memory::StdAllocator<BasicTensorImpl<eT>>()));
+                }
+
+                std::shared_ptr<BasicTensorImpl<eT>> impl = reuse<eT>();
+                impl->n_rows = 0;
+                impl->n_cols = 0;
+                return impl;
+            }
+
+            // A view of mem, owned by base.
+            template<typename eT>
+            std::shared_ptr<BasicTensorImpl<eT>> result(const std::shared_ptr<BasicTensorImpl<eT>> &base, eT *mem,
+                                                        arma::uword n_rows, arma::uword n_cols)
+            {
+                if (!replaying)
+                {
+                    return record(std::allocate_shared<BasicTensorImpl<eT>>(memory::StdAllocator<BasicTensorImpl<eT>>(),
+                                                                            base, mem, n_rows, n_cols));
+                }
+
+                std::shared_ptr<BasicTensorImpl<eT>> impl = reuse<eT>();
+                BasicTensorImpl<eT>::wrap(impl->data, mem, n_rows, n_cols);
+                impl->n_rows = n_rows;
+                impl->n_cols = n_cols;
+                impl->set_base(base);
+                return impl;
+            }
+
+            template<typename T, typename... Args>
+            std::shared_ptr<T> node(Args &&... args)
+            {
+                if (!replaying)
+                {
+                    std::shared_ptr<T> created = std::allocate_shared<T>(memory::StdAllocator<T>(),
+                                                                         std::forward<Args>(args)...);
+                    created->recycle_edges = true;
+                    nodes.push_back(created);
+                    return created;
+                }
+
+                if (next_node == nodes.size() || typeid(*nodes[next_node]) != typeid(T))
+                {
+                    throw diverged();
+                }
+
+                std::shared_ptr<Function> &slot = nodes[next_node++];
+
+                // Someone outside the capture still holds the old node (a graph kept with retain_graph, or history
+                // chained through an in-place operator), so it cannot be rebuilt underneath them.
+                if (slot.use_count() > 1)
+                {
+                    std::shared_ptr<T> created = std::allocate_shared<T>(memory::StdAllocator<T>(),
+                                                                         std::forward<Args>(args)...);
+                    created->recycle_edges = true;
+                    slot = created;
+                    return created;
+                }
+
+                return std::shared_ptr<T>(slot, rebuild(static_cast<T *>(slot.get()), std::forward<Args>(args)...));
+            }
+
+            // Runs backward over the records instead of building a graph from root.
+            void backward(const std::shared_ptr<TensorImplBase> &root, bool retain_graph)
+            {
+                if (!root->grad_fn)
+                {
+                    return;
+                }
+
+                // Recomputation during backward (checkpoints) must neither take from nor add to the records.
+                struct Pause
+                {
+                    Capture *previous;
+
+                    ~Pause()
+                    {
+                        current() = previous;
+                    }
+                } pause{current()};
+
+                current() = nullptr;
+                Engine::execute_tape(records, root.get(), retain_graph);
+            }
+
+            void begin_replay()
+            {
+                replaying = true;
+                next_result = 0;
+                next_node = 0;
+            }
+
+            void end_replay() const
+            {
+                if (next_result != records.size() || next_node != nodes.size())
+                {
+                    throw diverged();
+                }
+            }
+
+            static Capture *&current()
+            {
+                static thread_local Capture *capture = nullptr;
+                return capture;
+            }
+
+        private:
+            bool replaying = false;
+            std::size_t next_result = 0;
+            std::size_t next_node = 0;
+
+            static std::runtime_error diverged()
+            {
+                return std::runtime_error("A replayed graph must run the same operations in the same order as when "
+                                          "it was captured");
+            }
+
+            template<typename eT>
+            std::shared_ptr<BasicTensorImpl<eT>> record(std::shared_ptr<BasicTensorImpl<eT>> impl)
+            {
+                impl->recycle_grad = true;
+                records.push_back(impl);
+                return impl;
+            }
+
+            // The next recorded result, put back into the state of a freshly made one except for its data and
+            // gradient buffers, which are overwritten in place when the shape has not changed.
+            template<typename eT>
+            std::shared_ptr<BasicTensorImpl<eT>> reuse()
+            {
+                if (next_result == records.size() || typeid(*records[next_result]) != typeid(BasicTensorImpl<eT>))
+                {
+                    throw diverged();
+                }
+
+                auto impl = std::static_pointer_cast<BasicTensorImpl<eT>>(records[next_result++]);
+
+                if (impl->base)
+                {
+                    BasicTensorImpl<eT>::wrap(impl->data, nullptr, 0, 0);
+                    impl->set_base(nullptr);
+                }
+
+                impl->n_slices = 1;
+                impl->requires_grad = false;
+                impl->grad_fn.reset();
+                impl->release_grad();
+                return impl;
+            }
+
+            // The rebuilt node takes over the old one's edge lists (see Function::donate_edges()), so it allocates
+            // none. Function constructors only throw when allocating their edges fails, and by then the old node is
+            // gone, so a failure here cannot be recovered from.
+            template<typename T, typename... Args>
+            static T *rebuild(T *node, Args &&... args) noexcept
+            {
+                node->donate_edges();
+                node->~T();
+                T *rebuilt = new(node) T(std::forward<Args>(args)...);
+                rebuilt->recycle_edges = true;
+                return rebuilt;
+            }
+        };
+
+        // Owns a captured fn and the results, Functions and buffers it produced. replay() runs fn again with every
+        // operator reusing its captured result and node.
+        class CapturedGraph
+        {
+        public:
+            explicit CapturedGraph(std::function<void()> fn)
+                    : fn(std::move(fn)), capture(std::make_unique<Capture>())
+            {
+                run();
+            }
+
+            void replay()
+            {
+                capture->begin_replay();
+                run();
+                capture->end_replay();
+            }
+
+            // Number of results recorded.
+            std::size_t size() const
+            {
+                return capture->records.size();
+            }
+
+        private:
+            std::function<void()> fn;
+            std::unique_ptr<Capture> capture;
+
+            void run()
+            {
+                struct Restore
+                {
+                    Capture *previous;
+
+                    ~Restore()
+                    {
+                        Capture::current() = previous;
+                    }
+                } restore{Capture::current()};
+
+                Capture::current() = capture.get();
+                fn();
+            }
+        };
+    }
+
+    // Runs fn once, typically a forward pass ending in backward(), and records what it did. Calling replay() on the
+    // result runs the same steps again on whatever the inputs hold by then: no result tensor, Function, edge list,
+    // data or gradient buffer is allocated, results are recomputed into the buffers they had and backward walks the
+    // recorded order. State a node keeps of its own (max/min indices, relu masks, GELU pre-activations,
+    // cross-entropy labels) is still allocated by Armadillo on each run. fn has to
+    // issue the same operations every time, which holds for fixed shapes and no data-dependent control flow.
+    // Tensors fn returns through references are the captured results, so they are overwritten by each replay.
+    template<typename F>
+    autograd::CapturedGraph capture(F fn)
+    {
+        return autograd::CapturedGraph(std::function<void()>(std::move(fn)));
+    }
+}
+
+#endif // CAPTURE_HPP
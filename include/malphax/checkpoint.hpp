@@ -0,0 +1,187 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "base.hpp"
+#include "tensor.hpp"
+#include "engine.hpp"
+#include "grad_mode.hpp"
+#include "tape.hpp"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        // Saves only the segment's inputs. backward runs fn again on detached copies of them with grad recording on,
+        // pushes the output gradient through the rebuilt graph and hands the copies' gradients to the inputs.
+        template<typename eT, typename F, std::size_t N>
+        class Checkpoint_ : public Function
+        {
+        public:
+            std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> input_impls;
+            F fn;
+            BasicTensorImpl<eT> *C_impl;
+
+            Checkpoint_(const std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> &input_impls, const F &fn,
+                        BasicTensorImpl<eT> *C_impl)
+                    : input_impls(input_impls), fn(fn), C_impl(C_impl)
+            {
+                for (const auto &impl: input_impls)
+                {
+                    set_inputs(impl);
+                }
+            }
+
+            void backward() override
+            {
+                EnableGradGuard enable_grad;
+                std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> detached;
+
+                for (std::size_t k = 0; k < N; ++k)
+                {
+                    detached[k] = std::make_shared<BasicTensorImpl<eT>>(input_impls[k]->data,
+                                                                        input_impls[k]->needs_grad(C_impl));
+                    detached[k]->n_cols = input_impls[k]->n_cols;
+                    detached[k]->n_slices = input_impls[k]->n_slices;
+                    detached[k]->grad_epoch = C_impl->visit_epoch;
+                }
+
+                const unsigned long long id = next_segment();
+                // Held as a tensor so its data survives until the shape check below.
+                BasicTensor<eT> output_tensor;
+
+                {
+                    struct Restore
+                    {
+                        unsigned long long previous;
+
+                        ~Restore()
+                        {
+                            recording_segment() = previous;
+                        }
+                    } restore{recording_segment()};
+
+                    recording_segment() = id;
+                    output_tensor = recompute(detached, std::make_index_sequence<N>());
+                }
+
+                const std::shared_ptr<BasicTensorImpl<eT>> output = output_tensor.get_impl();
+
+                if (!C_impl->shaped_like(output->data))
+                {
+                    throw std::runtime_error("A checkpointed function must return the same shape when recomputed");
+                }
+
+                if (!output->requires_grad)
+                {
+                    return;
+                }
+
+                output->accumulate_grad(C_impl->grad);
+
+                if (output->grad_fn)
+                {
+                    Engine::execute_segment(output, id);
+                }
+
+                for (std::size_t k = 0; k < N; ++k)
+                {
+                    if (detached[k]->has_grad())
+                    {
+                        input_impls[k]->accumulate_grad(std::move(detached[k]->grad));
+                    }
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                for (auto &impl: input_impls)
+                {
+                    impl.reset();
+                }
+                Function::release_saved();
+            }
+
+        private:
+            template<std::size_t... I>
+            BasicTensor<eT> recompute(const std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> &args,
+                                      std::index_sequence<I...>)
+            {
+                return fn(BasicTensor<eT>(args[I])...);
+            }
+
+            static unsigned long long next_segment()
+            {
+                static std::atomic<unsigned long long> id{0};
+                return ++id;
+            }
+        };
+    }
+
+    // checkpoint(fn, t0, t1, ...) returns fn(t0, t1, ...) without keeping the graph fn builds; backward recomputes
+    // it instead. Tensors fn closes over that require grad must be leaves, anything computed has to be an argument.
+    template<typename F, typename eT, typename... Ts>
+    BasicTensor<eT> checkpoint(F fn, const BasicTensor<eT> &first, const Ts &... rest)
+    {
+        constexpr std::size_t N = 1 + sizeof...(Ts);
+        std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> impls{{first.get_impl(), rest.get_impl()...}};
+        bool requires_grad = false;
+
+        for (const auto &impl: impls)
+        {
+            requires_grad = requires_grad || impl->requires_grad;
+        }
+
+        auto result_impl = autograd::make_result<eT>();
+
+        {
+            NoGradGuard no_grad;
+            const BasicTensor<eT> output_tensor = fn(first, rest...);
+            const std::shared_ptr<BasicTensorImpl<eT>> output = output_tensor.get_impl();
+
+            result_impl->n_rows = output->n_rows;
+            result_impl->n_cols = output->n_cols;
+            result_impl->n_slices = output->n_slices;
+
+            // Only a fresh result that nothing else refers to is taken over. fn may hand back one of its arguments, a
+            // tensor it closes over or a view (t(), cols(), reshape(), ...) of either, whose storage the result must
+            // neither alias nor take away.
+            bool fresh = !output->base && !output->flat_storage && output->n_views.load() == 0 &&
+                         output.use_count() <= 2;
+
+            for (const auto &impl: impls)
+            {
+                fresh = fresh && impl != output;
+            }
+
+            if (fresh)
+                result_impl->take_data(*output);
+            else
+                result_impl->allocate_data(output->data.n_rows, output->data.n_cols) = output->data;
+        }
+
+        if (GradMode::is_enabled() && requires_grad)
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Checkpoint_<eT, F, N>>(
+                    impls,
+                    fn,
+                    result_impl.get()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+}
+
+#endif // CHECKPOINT_HPP
\ No newline at end of file
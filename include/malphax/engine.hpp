@@ -0,0 +1,622 @@
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+#include "base.hpp"
+#include "tensor_impl.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        class Engine
+        {
+        public:
+            struct Graph
+            {
+                std::vector<std::shared_ptr<TensorImplBase>> nodes;
+                std::vector<char> keep_grad;
+                unsigned long long epoch = 0;
+                bool all_targets = true;
+                bool retain_graph = false;
+
+                bool contains(const TensorImplBase *impl) const
+                {
+                    return impl && impl->visit_epoch == epoch && impl->grad_fn;
+                }
+
+                // Once a node has run nothing downstream needs its saved tensors, and dropping the engine's
+                // reference lets the intermediate itself go unless the caller still holds it.
+                void finish(std::size_t index)
+                {
+                    if (!keep_grad.empty() && !keep_grad[index])
+                    {
+                        nodes[index]->release_grad();
+                    }
+
+                    if (!retain_graph)
+                    {
+                        nodes[index]->grad_fn->release_saved();
+                        nodes[index].reset();
+                    }
+                }
+            };
+
+            static void execute(const std::shared_ptr<TensorImplBase> &root, bool retain_graph = false)
+            {
+                Graph graph = build_graph({root}, {});
+                graph.retain_graph = retain_graph;
+
+                // Interior gradients are rebuilt from the seed on every pass; stale ones from a retained graph
+                // would otherwise be counted twice.
+                for (std::size_t i = 0; i + 1 < graph.nodes.size(); ++i)
+                {
+                    graph.nodes[i]->release_grad();
+                }
+
+                run(graph);
+            }
+
+            // Gradients of roots (seeded with seeds, ones where a seed is empty) with respect to targets only.
+            // Nodes that lead to no target never run, and every grad buffer the pass touches is restored.
+            template<typename eT>
+            static std::vector<arma::Mat<eT>> execute_grad(const std::vector<std::shared_ptr<BasicTensorImpl<eT>>> &roots,
+                                                           const std::vector<arma::Mat<eT>> &seeds,
+                                                           const std::vector<std::shared_ptr<BasicTensorImpl<eT>>> &targets,
+                                                           bool retain_graph = false)
+            {
+                Graph graph = build_graph(std::vector<std::shared_ptr<TensorImplBase>>(roots.begin(), roots.end()),
+                                          std::vector<std::shared_ptr<TensorImplBase>>(targets.begin(), targets.end()));
+                graph.retain_graph = retain_graph;
+                graph.keep_grad.assign(graph.nodes.size(), 0);
+
+                for (const auto &target: targets)
+                {
+                    if (graph.contains(target.get()))
+                    {
+                        graph.keep_grad[target->topo_index] = 1;
+                    }
+                }
+
+                std::vector<std::pair<std::shared_ptr<BasicTensorImpl<eT>>, arma::Mat<eT>>> stashed;
+                auto stash = [&stashed](const std::shared_ptr<BasicTensorImpl<eT>> &impl)
+                {
+                    if (impl && impl->has_grad())
+                    {
+                        stashed.emplace_back(impl, impl->take_grad());
+                    }
+                };
+
+                for (const auto &root: roots) stash(root);
+                for (const auto &target: targets) stash(target);
+                for (const auto &node: graph.nodes) stash(std::dynamic_pointer_cast<BasicTensorImpl<eT>>(node));
+
+                for (std::size_t i = 0; i < roots.size(); ++i)
+                {
+                    if (i < seeds.size() && !seeds[i].is_empty())
+                        roots[i]->accumulate_grad(seeds[i]);
+                    else
+                        roots[i]->accumulate_grad(arma::Mat<eT>(roots[i]->data.n_rows, roots[i]->data.n_cols,
+                                                                arma::fill::ones));
+                }
+
+                run(graph);
+
+                std::vector<arma::Mat<eT>> grads(targets.size());
+
+                for (std::size_t i = 0; i < targets.size(); ++i)
+                {
+                    std::size_t first = 0;
+                    while (targets[first] != targets[i]) ++first;
+
+                    if (first != i)
+                        grads[i] = grads[first];
+                    else if (targets[i]->grad.is_empty())
+                        grads[i].zeros(targets[i]->data.n_rows, targets[i]->data.n_cols);
+                    else
+                        grads[i] = targets[i]->take_grad();
+
+                    targets[i]->release_grad();
+                }
+
+                for (const auto &root: roots) root->release_grad();
+
+                for (auto &entry: stashed)
+                {
+                    entry.first->release_grad();
+                    entry.first->accumulate_grad(std::move(entry.second));
+                }
+
+                return grads;
+            }
+
+            // Depth-first post-order over the grad_fn nodes reachable from roots, so walking it in reverse runs
+            // each Function once, after all of its consumers. With targets, only nodes that have a target below
+            // them are kept and only the targets and those nodes are marked as needing a gradient; an empty
+            // target list means every tensor that requires grad.
+            static Graph build_graph(const std::vector<std::shared_ptr<TensorImplBase>> &roots,
+                                     const std::vector<std::shared_ptr<TensorImplBase>> &targets)
+            {
+                std::vector<std::shared_ptr<TensorImplBase>> order;
+                const unsigned long long visit = next_epoch();
+
+                std::vector<std::pair<std::shared_ptr<TensorImplBase>, std::size_t>> stack;
+
+                for (const auto &root: roots)
+                {
+                    if (!root || !root->requires_grad || !root->grad_fn || root->visit_epoch == visit)
+                    {
+                        continue;
+                    }
+
+                    check_not_released(*root);
+                    root->visit_epoch = visit;
+                    stack.emplace_back(root, 0);
+
+                    while (!stack.empty())
+                    {
+                        auto &frame = stack.back();
+                        const auto &inputs = frame.first->grad_fn->input_tensor_impls;
+
+                        if (frame.second < inputs.size())
+                        {
+                            const std::shared_ptr<TensorImplBase> &input = inputs[frame.second++];
+
+                            if (input && input->requires_grad && input->grad_fn && input->visit_epoch != visit)
+                            {
+                                check_not_released(*input);
+                                input->visit_epoch = visit;
+                                stack.emplace_back(input, 0);
+                            }
+                        }
+                        else
+                        {
+                            order.push_back(std::move(frame.first));
+                            stack.pop_back();
+                        }
+                    }
+                }
+
+                Graph graph;
+                graph.epoch = next_epoch();
+                graph.all_targets = targets.empty();
+                const bool all_targets = graph.all_targets;
+
+                for (const auto &target: targets)
+                {
+                    target->grad_epoch = graph.epoch;
+                }
+
+                for (auto &node: order)
+                {
+                    bool leads_to_target = all_targets;
+
+                    for (const auto &input: node->grad_fn->input_tensor_impls)
+                    {
+                        if (!input || !input->requires_grad)
+                        {
+                            continue;
+                        }
+
+                        if (all_targets)
+                            input->grad_epoch = graph.epoch;
+                        else if (input->grad_epoch == graph.epoch)
+                            leads_to_target = true;
+                    }
+
+                    if (leads_to_target)
+                    {
+                        node->grad_epoch = graph.epoch;
+                        node->visit_epoch = graph.epoch;
+                        node->topo_index = graph.nodes.size();
+                        graph.nodes.push_back(std::move(node));
+                    }
+                }
+
+                return graph;
+            }
+
+            // Backward from the output of a checkpointed segment, recomputed and seeded by the Function running in
+            // the current pass. The segment's graph reuses that pass's epoch, so both agree on which tensors need a
+            // gradient, and it is built from the segment's own nodes only: any other tensor it reaches must be a leaf.
+            static void execute_segment(const std::shared_ptr<TensorImplBase> &root, unsigned long long segment)
+            {
+                const Graph *outer = running_graph();
+
+                if (!outer)
+                {
+                    throw std::runtime_error("A checkpointed segment can only be recomputed during backward");
+                }
+
+                Graph graph = build_segment(root, segment, outer->epoch, outer->all_targets);
+                run(graph);
+            }
+
+            // Backward over the records of a tape, which list every recorded result in creation order: one sweep
+            // forward up to root marks what needs a gradient, one sweep back runs the nodes. The root's gradient
+            // must already be seeded. With release_records, each record is dropped as soon as the pass is done with
+            // it, so results only the records held are freed during the pass rather than after it.
+            static void execute_tape(std::vector<std::shared_ptr<TensorImplBase>> &records, const TensorImplBase *root,
+                                     bool retain_graph, bool release_records = false)
+            {
+                std::size_t end = records.size();
+                while (end > 0 && records[end - 1].get() != root) --end;
+
+                if (end == 0)
+                {
+                    throw std::runtime_error("Tape backward() root was not recorded on this tape");
+                }
+
+                // An in-place operator puts a new node on a tensor recorded earlier, whose inputs may have been
+                // recorded after it; creation order is then no longer topological and the graph is searched instead.
+                if (!in_creation_order(records, end))
+                {
+                    execute(records[end - 1], retain_graph);
+                    return;
+                }
+
+                Graph graph;
+                graph.epoch = next_epoch();
+                graph.retain_graph = retain_graph;
+
+                for (std::size_t i = 0; i < end; ++i)
+                {
+                    TensorImplBase *node = records[i].get();
+
+                    if (!node->requires_grad || !node->grad_fn)
+                    {
+                        if (release_records && i + 1 < end) records[i].reset();
+                        continue;
+                    }
+
+                    check_not_released(*node);
+                    node->visit_epoch = graph.epoch;
+                    node->grad_epoch = graph.epoch;
+
+                    for (const auto &input: node->grad_fn->input_tensor_impls)
+                    {
+                        if (input && input->requires_grad) input->grad_epoch = graph.epoch;
+                    }
+
+                    if (i + 1 < end) node->release_grad();
+                }
+
+                for (std::size_t i = end; i-- > 0;)
+                {
+                    TensorImplBase *node = records[i].get();
+
+                    if (node && node->visit_epoch == graph.epoch && node->grad_fn && node->has_grad())
+                    {
+                        run_backward(graph, node);
+                        if (!retain_graph) node->grad_fn->release_saved();
+                    }
+
+                    if (release_records) records[i].reset();
+                }
+            }
+
+            static void set_num_threads(std::size_t n_threads)
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex());
+
+                if (n_threads <= 1)
+                {
+                    pool().reset();
+                }
+                else if (!pool() || pool()->size() != n_threads)
+                {
+                    pool() = std::make_shared<ThreadPool>(n_threads);
+                }
+            }
+
+            static std::size_t num_threads()
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex());
+                return pool() ? pool()->size() : 1;
+            }
+
+            // The pool set by set_num_threads(), or null when running single-threaded.
+            static std::shared_ptr<ThreadPool> shared_pool()
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex());
+                return pool();
+            }
+
+        private:
+            static Graph build_segment(const std::shared_ptr<TensorImplBase> &root, unsigned long long segment,
+                                       unsigned long long epoch, bool all_targets)
+            {
+                std::vector<std::shared_ptr<TensorImplBase>> order;
+                const unsigned long long visit = next_epoch();
+
+                std::vector<std::pair<std::shared_ptr<TensorImplBase>, std::size_t>> stack;
+                check_in_segment(*root, segment);
+                root->visit_epoch = visit;
+                stack.emplace_back(root, 0);
+
+                while (!stack.empty())
+                {
+                    auto &frame = stack.back();
+                    const auto &inputs = frame.first->grad_fn->input_tensor_impls;
+
+                    if (frame.second < inputs.size())
+                    {
+                        const std::shared_ptr<TensorImplBase> &input = inputs[frame.second++];
+
+                        if (!input || !input->requires_grad || !input->grad_fn || input->visit_epoch == visit)
+                        {
+                            continue;
+                        }
+
+                        check_in_segment(*input, segment);
+                        input->visit_epoch = visit;
+                        stack.emplace_back(input, 0);
+                    }
+                    else
+                    {
+                        order.push_back(std::move(frame.first));
+                        stack.pop_back();
+                    }
+                }
+
+                Graph graph;
+                graph.epoch = epoch;
+                graph.all_targets = all_targets;
+
+                for (auto &node: order)
+                {
+                    bool leads_to_target = false;
+
+                    for (const auto &input: node->grad_fn->input_tensor_impls)
+                    {
+                        if (!input || !input->requires_grad)
+                        {
+                            continue;
+                        }
+
+                        // Leaves the function closes over may be shared with the outer pass or with another
+                        // segment running on a different worker.
+                        if (all_targets && !input->grad_fn)
+                        {
+                            std::lock_guard<std::mutex> lock(input->grad_mutex);
+                            if (input->grad_epoch != epoch) input->grad_epoch = epoch;
+                        }
+
+                        if (input->grad_epoch == epoch)
+                        {
+                            leads_to_target = true;
+                        }
+                    }
+
+                    if (leads_to_target)
+                    {
+                        node->grad_epoch = epoch;
+                        node->visit_epoch = epoch;
+                        node->topo_index = graph.nodes.size();
+                        graph.nodes.push_back(std::move(node));
+                    }
+                }
+
+                return graph;
+            }
+
+            // The graph whose node is running backward on this thread, read by nodes that start a nested pass.
+            static const Graph *&running_graph()
+            {
+                static thread_local const Graph *graph = nullptr;
+                return graph;
+            }
+
+            static void run_backward(const Graph &graph, TensorImplBase *node)
+            {
+                struct Restore
+                {
+                    const Graph *previous;
+
+                    ~Restore()
+                    {
+                        running_graph() = previous;
+                    }
+                } restore{running_graph()};
+
+                running_graph() = &graph;
+                node->grad_fn->check_versions(*node);
+                node->grad_fn->backward();
+            }
+
+            static void run(Graph &graph)
+            {
+                if (graph.nodes.size() > 1 && !ThreadPool::on_worker_thread())
+                {
+                    std::shared_ptr<ThreadPool> workers = shared_pool();
+
+                    if (workers)
+                    {
+                        execute_parallel(graph, *workers);
+                        return;
+                    }
+                }
+
+                for (std::size_t i = graph.nodes.size(); i-- > 0;)
+                {
+                    TensorImplBase *node = graph.nodes[i].get();
+
+                    if (node->has_grad())
+                        run_backward(graph, node);
+
+                    graph.finish(i);
+                }
+            }
+
+            // Every node waits for one decrement per incoming edge and is scheduled by the consumer that
+            // brings its counter to zero, so independent branches run on different workers.
+            static void execute_parallel(Graph &graph, ThreadPool &workers)
+            {
+                const std::size_t n_nodes = graph.nodes.size();
+                std::unique_ptr<std::atomic<std::size_t>[]> pending(new std::atomic<std::size_t>[n_nodes]);
+
+                for (std::size_t i = 0; i < n_nodes; ++i)
+                {
+                    pending[i].store(0, std::memory_order_relaxed);
+                }
+
+                for (const auto &node: graph.nodes)
+                {
+                    for (const auto &input: node->grad_fn->input_tensor_impls)
+                    {
+                        if (graph.contains(input.get()))
+                        {
+                            pending[input->topo_index].fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                }
+
+                std::vector<TensorImplBase *> ready;
+
+                for (std::size_t i = 0; i < n_nodes; ++i)
+                {
+                    if (pending[i].load(std::memory_order_relaxed) == 0)
+                    {
+                        ready.push_back(graph.nodes[i].get());
+                    }
+                }
+
+                std::size_t remaining = n_nodes;
+                std::atomic<bool> failed{false};
+                std::exception_ptr error;
+                std::mutex done_mutex;
+                std::condition_variable done;
+
+                std::function<void(TensorImplBase *)> run_node = [&](TensorImplBase *node)
+                {
+                    if (!failed.load() && node->has_grad())
+                    {
+                        try
+                        {
+                            run_backward(graph, node);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(done_mutex);
+                            if (!error) error = std::current_exception();
+                            failed.store(true);
+                        }
+                    }
+
+                    for (const auto &input: node->grad_fn->input_tensor_impls)
+                    {
+                        if (graph.contains(input.get()) && pending[input->topo_index].fetch_sub(1) == 1)
+                        {
+                            TensorImplBase *next = input.get();
+                            workers.submit([&run_node, next]() { run_node(next); });
+                        }
+                    }
+
+                    graph.finish(node->topo_index);
+
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    if (--remaining == 0) done.notify_all();
+                };
+
+                for (TensorImplBase *node: ready)
+                {
+                    workers.submit([&run_node, node]() { run_node(node); });
+                }
+
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done.wait(lock, [&remaining]() { return remaining == 0; });
+
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+
+            static bool in_creation_order(const std::vector<std::shared_ptr<TensorImplBase>> &records, std::size_t end)
+            {
+                const unsigned long long listed = next_epoch();
+
+                for (std::size_t i = 0; i < end; ++i)
+                {
+                    records[i]->visit_epoch = listed;
+                    records[i]->topo_index = i;
+                }
+
+                for (std::size_t i = 0; i < end; ++i)
+                {
+                    if (!records[i]->grad_fn)
+                    {
+                        continue;
+                    }
+
+                    for (const auto &input: records[i]->grad_fn->input_tensor_impls)
+                    {
+                        if (input && input->visit_epoch == listed && input->topo_index > i)
+                        {
+                            return false;
+                        }
+                    }
+                }
+
+                return true;
+            }
+
+            static void check_not_released(const TensorImplBase &impl)
+            {
+                if (impl.grad_fn->is_released())
+                {
+                    throw std::runtime_error("Trying to backward through a graph whose saved tensors have already been "
+                                             "freed; pass retain_graph = true to the first backward() call");
+                }
+            }
+
+            static void check_in_segment(const TensorImplBase &impl, unsigned long long segment)
+            {
+                if (impl.grad_fn->segment != segment)
+                {
+                    throw std::runtime_error("A checkpointed function may only use tensors computed outside it "
+                                             "through its arguments");
+                }
+            }
+
+            static unsigned long long next_epoch()
+            {
+                static std::atomic<unsigned long long> epoch{0};
+                return ++epoch;
+            }
+
+            static std::shared_ptr<ThreadPool> &pool()
+            {
+                static std::shared_ptr<ThreadPool> instance;
+                return instance;
+            }
+
+            static std::mutex &pool_mutex()
+            {
+                static std::mutex mutex;
+                return mutex;
+            }
+        };
+
+        inline void set_num_threads(std::size_t n_threads)
+        {
+            Engine::set_num_threads(n_threads);
+        }
+
+        inline std::size_t num_threads()
+        {
+            return Engine::num_threads();
+        }
+    }
+}
+
+#endif // ENGINE_HPP
\ No newline at end of file
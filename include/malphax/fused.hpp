@@ -0,0 +1,451 @@
+#ifndef FUSED_HPP
+#define FUSED_HPP
+
+#include "tensor.hpp"
+#include "grad_mode.hpp"
+#include "tape.hpp"
+#include <array>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <armadillo>
+
+namespace Malphax
+{
+    // Elementwise chains written against symbolic leaves are compiled into one expression type, evaluated in a
+    // single loop over the operands and differentiated by one Fused_ node that keeps nothing but its inputs.
+    //
+    // Backward runs two passes per element. forward() evaluates the tree bottom-up once, storing every node's
+    // operands in a Cache<eT> shaped like the tree, and backward() walks it top-down reading them back, so each
+    // subexpression is computed once per element however deep the chain is.
+    namespace fused
+    {
+        struct Expr
+        {};
+
+        template<typename T>
+        struct is_expr : std::is_base_of<Expr, T>
+        {};
+
+        template<std::size_t I>
+        struct Leaf : Expr
+        {
+            template<typename eT>
+            struct Cache
+            {};
+
+            template<typename eT>
+            eT value(const eT *const *in, arma::uword i) const
+            {
+                return in[I][i];
+            }
+
+            template<typename eT>
+            eT forward(const eT *const *in, arma::uword i, Cache<eT> &) const
+            {
+                return in[I][i];
+            }
+
+            template<typename eT>
+            void backward(const Cache<eT> &, arma::uword i, eT g, eT *const *out) const
+            {
+                if (out[I]) out[I][i] += g;
+            }
+        };
+
+        struct Scalar : Expr
+        {
+            double v;
+
+            explicit Scalar(double v) : v(v)
+            {}
+
+            template<typename eT>
+            struct Cache
+            {};
+
+            template<typename eT>
+            eT value(const eT *const *, arma::uword) const
+            {
+                return static_cast<eT>(v);
+            }
+
+            template<typename eT>
+            eT forward(const eT *const *, arma::uword, Cache<eT> &) const
+            {
+                return static_cast<eT>(v);
+            }
+
+            template<typename eT>
+            void backward(const Cache<eT> &, arma::uword, eT, eT *const *) const
+            {}
+        };
+
+        struct AddOp
+        {
+            template<typename eT>
+            static eT apply(eT a, eT b) { return a + b; }
+
+            template<typename eT>
+            static eT d_left(eT, eT) { return eT(1); }
+
+            template<typename eT>
+            static eT d_right(eT, eT) { return eT(1); }
+        };
+
+        struct SubOp
+        {
+            template<typename eT>
+            static eT apply(eT a, eT b) { return a - b; }
+
+            template<typename eT>
+            static eT d_left(eT, eT) { return eT(1); }
+
+            template<typename eT>
+            static eT d_right(eT, eT) { return eT(-1); }
+        };
+
+        struct MulOp
+        {
+            template<typename eT>
+            static eT apply(eT a, eT b) { return a * b; }
+
+            template<typename eT>
+            static eT d_left(eT, eT b) { return b; }
+
+            template<typename eT>
+            static eT d_right(eT a, eT) { return a; }
+        };
+
+        struct DivOp
+        {
+            template<typename eT>
+            static eT apply(eT a, eT b) { return a / b; }
+
+            template<typename eT>
+            static eT d_left(eT, eT b) { return eT(1) / b; }
+
+            template<typename eT>
+            static eT d_right(eT a, eT b) { return -a / (b * b); }
+        };
+
+        // Unary derivatives get the operand a and the result y = apply(a), whichever is cheaper to use.
+        struct NegOp
+        {
+            template<typename eT>
+            static eT apply(eT a) { return -a; }
+
+            template<typename eT>
+            static eT derivative(eT, eT) { return eT(-1); }
+        };
+
+        struct ExpOp
+        {
+            template<typename eT>
+            static eT apply(eT a) { return std::exp(a); }
+
+            template<typename eT>
+            static eT derivative(eT, eT y) { return y; }
+        };
+
+        struct LogOp
+        {
+            template<typename eT>
+            static eT apply(eT a) { return std::log(a); }
+
+            template<typename eT>
+            static eT derivative(eT a, eT) { return eT(1) / a; }
+        };
+
+        struct AbsOp
+        {
+            template<typename eT>
+            static eT apply(eT a) { return std::abs(a); }
+
+            template<typename eT>
+            static eT derivative(eT a, eT) { return static_cast<eT>((a > eT(0)) - (a < eT(0))); }
+        };
+
+        template<typename Op, typename L, typename R>
+        struct Binary : Expr
+        {
+            L l;
+            R r;
+
+            Binary(const L &l, const R &r) : l(l), r(r)
+            {}
+
+            template<typename eT>
+            struct Cache
+            {
+                typename L::template Cache<eT> l;
+                typename R::template Cache<eT> r;
+                eT a;
+                eT b;
+            };
+
+            template<typename eT>
+            eT value(const eT *const *in, arma::uword i) const
+            {
+                return Op::apply(l.value(in, i), r.value(in, i));
+            }
+
+            template<typename eT>
+            eT forward(const eT *const *in, arma::uword i, Cache<eT> &c) const
+            {
+                c.a = l.forward(in, i, c.l);
+                c.b = r.forward(in, i, c.r);
+                return Op::apply(c.a, c.b);
+            }
+
+            template<typename eT>
+            void backward(const Cache<eT> &c, arma::uword i, eT g, eT *const *out) const
+            {
+                l.backward(c.l, i, g * Op::d_left(c.a, c.b), out);
+                r.backward(c.r, i, g * Op::d_right(c.a, c.b), out);
+            }
+        };
+
+        template<typename Op, typename E>
+        struct Unary : Expr
+        {
+            E e;
+
+            explicit Unary(const E &e) : e(e)
+            {}
+
+            template<typename eT>
+            struct Cache
+            {
+                typename E::template Cache<eT> e;
+                eT a;
+                eT y;
+            };
+
+            template<typename eT>
+            eT value(const eT *const *in, arma::uword i) const
+            {
+                return Op::apply(e.value(in, i));
+            }
+
+            template<typename eT>
+            eT forward(const eT *const *in, arma::uword i, Cache<eT> &c) const
+            {
+                c.a = e.forward(in, i, c.e);
+                c.y = Op::apply(c.a);
+                return c.y;
+            }
+
+            template<typename eT>
+            void backward(const Cache<eT> &c, arma::uword i, eT g, eT *const *out) const
+            {
+                e.backward(c.e, i, g * Op::derivative(c.a, c.y), out);
+            }
+        };
+
+        template<typename T, typename std::enable_if<is_expr<T>::value, int>::type = 0>
+        const T &as_expr(const T &e)
+        {
+            return e;
+        }
+
+        template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        Scalar as_expr(const T &v)
+        {
+            return Scalar(static_cast<double>(v));
+        }
+
+        template<typename L, typename R>
+        using enable_binary = typename std::enable_if<
+                (is_expr<L>::value || is_expr<R>::value) &&
+                (is_expr<L>::value || std::is_arithmetic<L>::value) &&
+                (is_expr<R>::value || std::is_arithmetic<R>::value), int>::type;
+
+        template<typename Op, typename L, typename R>
+        using binary_t = Binary<Op, typename std::decay<decltype(as_expr(std::declval<L>()))>::type,
+                typename std::decay<decltype(as_expr(std::declval<R>()))>::type>;
+
+        template<typename L, typename R, enable_binary<L, R> = 0>
+        binary_t<AddOp, L, R> operator+(const L &l, const R &r)
+        {
+            return binary_t<AddOp, L, R>(as_expr(l), as_expr(r));
+        }
+
+        template<typename L, typename R, enable_binary<L, R> = 0>
+        binary_t<SubOp, L, R> operator-(const L &l, const R &r)
+        {
+            return binary_t<SubOp, L, R>(as_expr(l), as_expr(r));
+        }
+
+        template<typename L, typename R, enable_binary<L, R> = 0>
+        binary_t<MulOp, L, R> operator*(const L &l, const R &r)
+        {
+            return binary_t<MulOp, L, R>(as_expr(l), as_expr(r));
+        }
+
+        template<typename L, typename R, enable_binary<L, R> = 0>
+        binary_t<DivOp, L, R> operator/(const L &l, const R &r)
+        {
+            return binary_t<DivOp, L, R>(as_expr(l), as_expr(r));
+        }
+
+        template<typename E, typename std::enable_if<is_expr<E>::value, int>::type = 0>
+        Unary<NegOp, E> operator-(const E &e)
+        {
+            return Unary<NegOp, E>(e);
+        }
+
+        template<typename E, typename std::enable_if<is_expr<E>::value, int>::type = 0>
+        Unary<ExpOp, E> exp(const E &e)
+        {
+            return Unary<ExpOp, E>(e);
+        }
+
+        template<typename E, typename std::enable_if<is_expr<E>::value, int>::type = 0>
+        Unary<LogOp, E> log(const E &e)
+        {
+            return Unary<LogOp, E>(e);
+        }
+
+        template<typename E, typename std::enable_if<is_expr<E>::value, int>::type = 0>
+        Unary<AbsOp, E> abs(const E &e)
+        {
+            return Unary<AbsOp, E>(e);
+        }
+
+        template<typename F, std::size_t... I>
+        auto trace(F f, std::index_sequence<I...>) -> decltype(f(Leaf<I>()...))
+        {
+            return f(Leaf<I>()...);
+        }
+    }
+
+    namespace autograd
+    {
+        template<typename eT, typename E, std::size_t N>
+        class Fused_ : public Function
+        {
+        public:
+            std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> input_impls;
+            E expr;
+            BasicTensorImpl<eT> *C_impl;
+
+            Fused_(const std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> &input_impls, const E &expr,
+                   BasicTensorImpl<eT> *C_impl)
+                    : input_impls(input_impls), expr(expr), C_impl(C_impl)
+            {
+                for (const auto &impl: input_impls)
+                {
+                    set_inputs(impl);
+                }
+            }
+
+            void backward() override
+            {
+                const eT *in[N];
+                eT *out[N];
+                std::array<arma::Mat<eT>, N> contributions;
+
+                for (std::size_t k = 0; k < N; ++k)
+                {
+                    in[k] = input_impls[k]->data.memptr();
+                    out[k] = nullptr;
+
+                    if (input_impls[k]->needs_grad(C_impl))
+                    {
+                        contributions[k].zeros(C_impl->n_rows, C_impl->n_cols * C_impl->n_slices);
+                        out[k] = contributions[k].memptr();
+                    }
+                }
+
+                const eT *g = C_impl->grad.memptr();
+                const arma::uword n_elem = C_impl->grad.n_elem;
+                typename E::template Cache<eT> cache;
+
+                for (arma::uword i = 0; i < n_elem; ++i)
+                {
+                    expr.forward(in, i, cache);
+                    expr.backward(cache, i, g[i], out);
+                }
+
+                for (std::size_t k = 0; k < N; ++k)
+                {
+                    if (out[k]) input_impls[k]->accumulate_grad(std::move(contributions[k]));
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs;
+            }
+
+            void release_saved() override
+            {
+                for (auto &impl: input_impls)
+                {
+                    impl.reset();
+                }
+                Function::release_saved();
+            }
+        };
+    }
+
+    // fuse(f, t0, t1, ...) calls f once with symbolic leaves standing for t0, t1, ... and evaluates the
+    // returned expression, e.g. fuse([](auto x, auto c) { return exp(x * c + c / 16); }, matmul(a, b), c).
+    template<typename F, typename eT, typename... Ts>
+    BasicTensor<eT> fuse(F f, const BasicTensor<eT> &first, const Ts &... rest)
+    {
+        constexpr std::size_t N = 1 + sizeof...(Ts);
+        auto expr = fused::trace(f, std::make_index_sequence<N>());
+        std::array<std::shared_ptr<BasicTensorImpl<eT>>, N> impls{{first.get_impl(), rest.get_impl()...}};
+
+        const arma::uword n_rows = impls[0]->data.n_rows;
+        const arma::uword n_cols = impls[0]->data.n_cols;
+        const arma::uword n_slices = impls[0]->n_slices;
+        const eT *in[N];
+        bool requires_grad = false;
+
+        for (std::size_t k = 0; k < N; ++k)
+        {
+            if (impls[k]->data.n_rows != n_rows || impls[k]->data.n_cols != n_cols || impls[k]->n_slices != n_slices)
+            {
+                throw std::runtime_error("Fused operands must all have the same shape");
+            }
+
+            in[k] = impls[k]->data.memptr();
+            requires_grad = requires_grad || impls[k]->requires_grad;
+        }
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = n_rows;
+        result_impl->n_cols = n_cols / n_slices;
+        result_impl->n_slices = n_slices;
+        result_impl->allocate_data(n_rows, n_cols);
+
+        eT *out = result_impl->data.memptr();
+        const arma::uword n_elem = result_impl->data.n_elem;
+
+        for (arma::uword i = 0; i < n_elem; ++i)
+        {
+            out[i] = expr.value(in, i);
+        }
+
+        if (GradMode::is_enabled() && requires_grad)
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Fused_<eT, decltype(expr), N>>(
+                    impls,
+                    expr,
+                    result_impl.get()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+}
+
+#endif // FUSED_HPP
\ No newline at end of file
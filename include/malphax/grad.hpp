@@ -0,0 +1,83 @@
+#ifndef GRAD_HPP
+#define GRAD_HPP
+
+#include "tensor.hpp"
+#include "engine.hpp"
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        template<typename eT>
+        std::vector<BasicTensor<eT>> grad(const std::vector<BasicTensor<eT>> &outputs,
+                                          const std::vector<BasicTensor<eT>> &inputs,
+                                          const std::vector<BasicTensor<eT>> &grad_outputs = {}, bool retain_graph = false)
+        {
+            if (!grad_outputs.empty() && grad_outputs.size() != outputs.size())
+            {
+                throw std::runtime_error("grad_outputs must be empty or hold one tensor per output");
+            }
+
+            std::vector<std::shared_ptr<BasicTensorImpl<eT>>> roots;
+            std::vector<arma::Mat<eT>> seeds;
+
+            for (std::size_t i = 0; i < outputs.size(); ++i)
+            {
+                roots.push_back(outputs[i].get_impl());
+
+                if (!grad_outputs.empty())
+                {
+                    const BasicTensor<eT> &seed = grad_outputs[i];
+
+                    if (seed.n_rows() != outputs[i].n_rows() || seed.n_cols() != outputs[i].n_cols() ||
+                        seed.n_slices() != outputs[i].n_slices())
+                    {
+                        throw std::runtime_error("grad_outputs shape does not match its output");
+                    }
+
+                    seeds.push_back(grad_outputs[i].data());
+                }
+            }
+
+            std::vector<std::shared_ptr<BasicTensorImpl<eT>>> targets;
+
+            for (const auto &input: inputs)
+            {
+                targets.push_back(input.get_impl());
+            }
+
+            std::vector<arma::Mat<eT>> grads = Engine::execute_grad<eT>(roots, seeds, targets, retain_graph);
+
+            std::vector<BasicTensor<eT>> result;
+
+            for (auto &g: grads)
+            {
+                result.emplace_back(std::make_shared<BasicTensorImpl<eT>>(std::move(g), false));
+            }
+
+            return result;
+        }
+
+        template<typename eT>
+        std::vector<BasicTensor<eT>> grad(std::initializer_list<BasicTensor<eT>> outputs,
+                                          std::initializer_list<BasicTensor<eT>> inputs,
+                                          std::initializer_list<BasicTensor<eT>> grad_outputs = {},
+                                          bool retain_graph = false)
+        {
+            return grad(std::vector<BasicTensor<eT>>(outputs), std::vector<BasicTensor<eT>>(inputs),
+                        std::vector<BasicTensor<eT>>(grad_outputs), retain_graph);
+        }
+
+        template<typename eT>
+        BasicTensor<eT> grad(const BasicTensor<eT> &output, const BasicTensor<eT> &input, bool retain_graph = false)
+        {
+            return grad(std::vector<BasicTensor<eT>>{output}, std::vector<BasicTensor<eT>>{input}, {}, retain_graph)[0];
+        }
+    }
+}
+
+#endif // GRAD_HPP
\ No newline at end of file
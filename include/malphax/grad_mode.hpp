@@ -0,0 +1,116 @@
+#ifndef GRAD_MODE_HPP
+#define GRAD_MODE_HPP
+
+namespace Malphax
+{
+    // Thread-local switches read by the operators before they record a grad_fn.
+    class GradMode
+    {
+    public:
+        static bool is_enabled()
+        {
+            return enabled();
+        }
+
+        static void set_enabled(bool enabled_in)
+        {
+            enabled() = enabled_in;
+        }
+
+        static bool is_inference()
+        {
+            return inference();
+        }
+
+        static void set_inference(bool inference_in)
+        {
+            inference() = inference_in;
+        }
+
+    private:
+        static bool &enabled()
+        {
+            static thread_local bool flag = true;
+            return flag;
+        }
+
+        static bool &inference()
+        {
+            static thread_local bool flag = false;
+            return flag;
+        }
+    };
+
+    class NoGradGuard
+    {
+    public:
+        NoGradGuard() : prev_enabled(GradMode::is_enabled())
+        {
+            GradMode::set_enabled(false);
+        }
+
+        NoGradGuard(const NoGradGuard &) = delete;
+
+        NoGradGuard &operator=(const NoGradGuard &) = delete;
+
+        ~NoGradGuard()
+        {
+            GradMode::set_enabled(prev_enabled);
+        }
+
+    private:
+        bool prev_enabled;
+    };
+
+    // Records again inside a NoGradGuard or InferenceMode scope, e.g. while backward recomputes a checkpoint.
+    class EnableGradGuard
+    {
+    public:
+        EnableGradGuard() : prev_enabled(GradMode::is_enabled()), prev_inference(GradMode::is_inference())
+        {
+            GradMode::set_enabled(true);
+            GradMode::set_inference(false);
+        }
+
+        EnableGradGuard(const EnableGradGuard &) = delete;
+
+        EnableGradGuard &operator=(const EnableGradGuard &) = delete;
+
+        ~EnableGradGuard()
+        {
+            GradMode::set_enabled(prev_enabled);
+            GradMode::set_inference(prev_inference);
+        }
+
+    private:
+        bool prev_enabled;
+        bool prev_inference;
+    };
+
+    // Stricter than NoGradGuard: tensors constructed inside never require grad and get no grad buffer.
+    class InferenceMode
+    {
+    public:
+        InferenceMode() : prev_enabled(GradMode::is_enabled()), prev_inference(GradMode::is_inference())
+        {
+            GradMode::set_enabled(false);
+            GradMode::set_inference(true);
+        }
+
+        InferenceMode(const InferenceMode &) = delete;
+
+        InferenceMode &operator=(const InferenceMode &) = delete;
+
+        ~InferenceMode()
+        {
+            GradMode::set_enabled(prev_enabled);
+            GradMode::set_inference(prev_inference);
+        }
+
+    private:
+        bool prev_enabled;
+        bool prev_inference;
+    };
+}
+
+#endif // GRAD_MODE_HPP
\ No newline at end of file
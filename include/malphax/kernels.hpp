@@ -0,0 +1,135 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <armadillo>
+
+namespace Malphax
+{
+    // Backward kernels that write into a gradient buffer handed out by TensorImpl::update_grad(): with overwrite
+    // the buffer is freshly sized and is assigned, otherwise the contribution is added in place.
+    namespace kernels
+    {
+        // dst (+)= f(k) for every element k.
+        template<typename eT, typename F>
+        void accumulate(arma::Mat<eT> &dst, bool overwrite, F f)
+        {
+            eT *d = dst.memptr();
+            const arma::uword n_elem = dst.n_elem;
+
+            if (overwrite)
+                for (arma::uword k = 0; k < n_elem; ++k) d[k] = f(k);
+            else
+                for (arma::uword k = 0; k < n_elem; ++k) d[k] += f(k);
+        }
+
+        // One bit per element, for a backward that only needs to know where a condition held in the forward pass.
+        class BitMask
+        {
+        public:
+            explicit BitMask(arma::uword n_elem = 0) : words((n_elem + 63) / 64, 0)
+            {}
+
+            void set(arma::uword k)
+            {
+                words[k >> 6] |= std::uint64_t(1) << (k & 63);
+            }
+
+            bool test(arma::uword k) const
+            {
+                return (words[k >> 6] >> (k & 63)) & 1u;
+            }
+
+            void reset()
+            {
+                words.clear();
+                words.shrink_to_fit();
+            }
+
+        private:
+            std::vector<std::uint64_t> words;
+        };
+
+        // Slice k of M, which holds n_slices matrices side by side, as a matrix sharing M's memory. A single slice
+        // stands for every k, which is how a batch broadcasts one matrix.
+        template<typename eT>
+        arma::Mat<eT> slice(const arma::Mat<eT> &M, arma::uword n_slices, arma::uword k)
+        {
+            const arma::uword n_cols = M.n_cols / n_slices;
+            eT *mem = const_cast<eT *>(M.memptr()) + (n_slices == 1 ? 0 : k * M.n_rows * n_cols);
+
+            return arma::Mat<eT>(mem, M.n_rows, n_cols, false, true);
+        }
+
+        // Adds G into the block of dst whose top-left element is (first_row, first_col); with overwrite the rest of
+        // dst is zeroed.
+        template<typename eT>
+        void scatter(arma::Mat<eT> &dst, bool overwrite, const arma::Mat<eT> &G, arma::uword first_row,
+                     arma::uword first_col)
+        {
+            if (overwrite) dst.zeros();
+
+            for (arma::uword j = 0; j < G.n_cols; ++j)
+            {
+                eT *d = dst.colptr(first_col + j) + first_row;
+                const eT *g = G.colptr(j);
+
+                for (arma::uword i = 0; i < G.n_rows; ++i) d[i] += g[i];
+            }
+        }
+
+        // dst (+)= op(A) * op(B), op being a transpose where asked; a single gemm with beta = 1 when accumulating.
+        template<typename eT>
+        void gemm(arma::Mat<eT> &dst, bool overwrite, const arma::Mat<eT> &A, bool trans_A, const arma::Mat<eT> &B,
+                  bool trans_B)
+        {
+            const arma::uword k = trans_A ? A.n_rows : A.n_cols;
+
+            if (dst.is_empty())
+            {
+                return;
+            }
+
+            if (k == 0)
+            {
+                if (overwrite) dst.zeros();
+                return;
+            }
+
+#if defined(ARMA_USE_BLAS)
+            const char transA = trans_A ? 'T' : 'N';
+            const char transB = trans_B ? 'T' : 'N';
+            const arma::blas_int m = static_cast<arma::blas_int>(dst.n_rows);
+            const arma::blas_int n = static_cast<arma::blas_int>(dst.n_cols);
+            const arma::blas_int kk = static_cast<arma::blas_int>(k);
+            const arma::blas_int ldA = static_cast<arma::blas_int>(std::max<arma::uword>(A.n_rows, 1));
+            const arma::blas_int ldB = static_cast<arma::blas_int>(std::max<arma::uword>(B.n_rows, 1));
+            const arma::blas_int ldC = static_cast<arma::blas_int>(std::max<arma::uword>(dst.n_rows, 1));
+            const eT alpha = eT(1);
+            const eT beta = overwrite ? eT(0) : eT(1);
+
+            arma::blas::gemm<eT>(&transA, &transB, &m, &n, &kk, &alpha, A.memptr(), &ldA, B.memptr(), &ldB, &beta,
+                                 dst.memptr(), &ldC);
+#else
+            if (overwrite)
+            {
+                if (trans_A && trans_B) dst = A.t() * B.t();
+                else if (trans_A) dst = A.t() * B;
+                else if (trans_B) dst = A * B.t();
+                else dst = A * B;
+            }
+            else
+            {
+                if (trans_A && trans_B) dst += A.t() * B.t();
+                else if (trans_A) dst += A.t() * B;
+                else if (trans_B) dst += A * B.t();
+                else dst += A * B;
+            }
+#endif
+        }
+    }
+}
+
+#endif // KERNELS_HPP
\ No newline at end of file
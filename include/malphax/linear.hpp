@@ -0,0 +1,185 @@
+#ifndef LINEAR_HPP
+#define LINEAR_HPP
+
+#include "base.hpp"
+#include "tensor.hpp"
+#include "grad_mode.hpp"
+#include "kernels.hpp"
+#include "tape.hpp"
+#include "activation.hpp"
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <armadillo>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        // Y = act(X * W + b) as one node. backward turns dY into dZ in a single pass, reading the activation's
+        // derivative off the output (ReLU, tanh) or the kept pre-activation (GELU), then dX = dZ * W^T and
+        // dW = X^T * dZ are gemms with transpose flags and db sums dZ down the rows.
+        template<typename eT>
+        class Linear_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> X_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> W_impl;
+            std::shared_ptr<BasicTensorImpl<eT>> b_impl;
+            BasicTensorImpl<eT> *C_impl;
+            Activation act;
+            arma::Mat<eT> pre_activation;
+
+            Linear_(const std::shared_ptr<BasicTensorImpl<eT>> &X_impl,
+                    const std::shared_ptr<BasicTensorImpl<eT>> &W_impl,
+                    const std::shared_ptr<BasicTensorImpl<eT>> &b_impl, BasicTensorImpl<eT> *C_impl, Activation act,
+                    arma::Mat<eT> &&pre_activation)
+                    : X_impl(X_impl), W_impl(W_impl), b_impl(b_impl), C_impl(C_impl), act(act),
+                      pre_activation(std::move(pre_activation))
+            {
+                set_inputs(X_impl, W_impl);
+                set_inputs(b_impl);
+            }
+
+            void backward() override
+            {
+                const arma::Mat<eT> &g = C_impl->grad;
+                arma::Mat<eT> delta;
+
+                if (act != Activation::Identity)
+                {
+                    delta.set_size(g.n_rows, g.n_cols);
+
+                    const eT *y = activation::needs_input(act) ? pre_activation.memptr() : C_impl->data.memptr();
+                    kernels::accumulate(delta, true, [&](arma::uword k) { return g[k] * derivative(y[k]); });
+                }
+
+                const arma::Mat<eT> &dz = act == Activation::Identity ? g : delta;
+
+                if (X_impl->needs_grad(C_impl))
+                    X_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        { kernels::gemm(grad, overwrite, dz, false, W_impl->data, true); });
+
+                if (W_impl->needs_grad(C_impl))
+                    W_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        { kernels::gemm(grad, overwrite, X_impl->data, true, dz, false); });
+
+                if (b_impl->needs_grad(C_impl))
+                    b_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            for (arma::uword j = 0; j < dz.n_cols; ++j)
+                                            {
+                                                const eT *d = dz.colptr(j);
+                                                eT s = eT(0);
+
+                                                for (arma::uword i = 0; i < dz.n_rows; ++i) s += d[i];
+
+                                                grad[j] = overwrite ? s : grad[j] + s;
+                                            }
+                                        });
+            }
+
+            unsigned saved_values() const override
+            {
+                if (act == Activation::Identity) return SavesInputs;
+                return SavesInputs | (activation::needs_input(act) ? SavesDerivative : SavesOutput);
+            }
+
+            void release_saved() override
+            {
+                X_impl.reset();
+                W_impl.reset();
+                b_impl.reset();
+                pre_activation.reset();
+                Function::release_saved();
+            }
+
+        private:
+            eT derivative(eT v) const
+            {
+                switch (act)
+                {
+                    case Activation::ReLU:
+                        return activation::relu_derivative(v);
+                    case Activation::GELU:
+                        return activation::gelu_derivative(v);
+                    case Activation::Tanh:
+                        return activation::tanh_derivative(v);
+                    default:
+                        return eT(1);
+                }
+            }
+        };
+    }
+
+    // act(x * W + b) for x of n x in, W of in x out and b of 1 x out: one gemm whose epilogue adds the bias and
+    // applies the activation in the same pass, recorded as a single node.
+    template<typename eT>
+    BasicTensor<eT> linear(const BasicTensor<eT> &x, const BasicTensor<eT> &W, const BasicTensor<eT> &b,
+                           Activation act = Activation::Identity)
+    {
+        if (x.n_slices() != 1 || W.n_slices() != 1)
+        {
+            throw std::runtime_error("linear() takes matrices; reshape batches into rows first");
+        }
+
+        if (x.n_cols() != W.n_rows())
+        {
+            throw std::runtime_error("Matrix multiplication dimension mismatch");
+        }
+
+        if (b.n_rows() != 1 || b.n_cols() != W.n_cols() || b.n_slices() != 1)
+        {
+            throw std::runtime_error("linear() requires a bias of one row with a column per output");
+        }
+
+        const bool requires_grad = GradMode::is_enabled() && (x.requires_grad() || W.requires_grad() ||
+                                                               b.requires_grad());
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = x.n_rows();
+        result_impl->n_cols = W.n_cols();
+        result_impl->allocate_data(result_impl->n_rows, result_impl->n_cols);
+        kernels::gemm(result_impl->data, true, x.data(), false, W.data(), false);
+
+        arma::Mat<eT> &y = result_impl->data;
+        const eT *bias = b.data().memptr();
+        arma::Mat<eT> pre_activation;
+
+        if (requires_grad && activation::needs_input(act))
+        {
+            pre_activation.set_size(y.n_rows, y.n_cols);
+        }
+
+        for (arma::uword j = 0; j < y.n_cols; ++j)
+        {
+            eT *out = y.colptr(j);
+            eT *pre = pre_activation.is_empty() ? nullptr : pre_activation.colptr(j);
+
+            for (arma::uword i = 0; i < y.n_rows; ++i)
+            {
+                const eT z = out[i] + bias[j];
+                if (pre) pre[i] = z;
+                out[i] = activation::apply(act, z);
+            }
+        }
+
+        if (requires_grad)
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Linear_<eT>>(
+                    x.get_impl(),
+                    W.get_impl(),
+                    b.get_impl(),
+                    result_impl.get(),
+                    act,
+                    std::move(pre_activation)
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+}
+
+#endif // LINEAR_HPP
\ No newline at end of file
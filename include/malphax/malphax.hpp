@@ -4,8 +4,21 @@
 #include "base.hpp"
 #include "tensor_impl.hpp"
 #include "tensor.hpp"
+#include "broadcast.hpp"
+#include "reduction.hpp"
 #include "autograd.hpp"
 #include "operators.hpp"
+#include "grad.hpp"
+#include "memory.hpp"
+#include "fused.hpp"
+#include "tape.hpp"
+#include "checkpoint.hpp"
+#include "activation.hpp"
+#include "linear.hpp"
+#include "softmax.hpp"
+#include "parameters.hpp"
+#include "optim.hpp"
+#include "capture.hpp"
 
 
 
@@ -0,0 +1,350 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Storage Malphax allocates for itself: the data and gradient buffers of operator results (see Block), and the
+// tensors, Functions and edge lists of a graph (see StdAllocator). Matrices owned by user code, and intermediates
+// Armadillo allocates inside an expression, keep using Armadillo's own allocator.
+namespace Malphax
+{
+    namespace memory
+    {
+        constexpr std::size_t alignment = 32;
+
+        struct Stats
+        {
+            // Buffers obtained from and returned to the system; flat once a training loop has warmed up a pool.
+            std::size_t system_allocations = 0;
+            std::size_t system_releases = 0;
+            // Blocks and objects handed out and given back through the installed Allocator.
+            std::size_t acquired = 0;
+            std::size_t released = 0;
+        };
+
+        namespace detail
+        {
+            struct Counters
+            {
+                std::atomic<std::size_t> system_allocations{0};
+                std::atomic<std::size_t> system_releases{0};
+                std::atomic<std::size_t> acquired{0};
+                std::atomic<std::size_t> released{0};
+            };
+
+            inline Counters &counters()
+            {
+                static Counters instance;
+                return instance;
+            }
+        }
+
+        inline void *system_allocate(std::size_t bytes)
+        {
+            detail::counters().system_allocations.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(bytes, std::align_val_t(alignment));
+        }
+
+        inline void system_release(void *ptr)
+        {
+            detail::counters().system_releases.fetch_add(1, std::memory_order_relaxed);
+            ::operator delete(ptr, std::align_val_t(alignment));
+        }
+
+        // Hands out blocks of at least the requested size, aligned to memory::alignment. deallocate() receives the
+        // size that was requested.
+        class Allocator
+        {
+        public:
+            virtual void *allocate(std::size_t bytes) = 0;
+
+            virtual void deallocate(void *ptr, std::size_t bytes) = 0;
+
+            virtual ~Allocator() = default;
+        };
+
+        class HeapAllocator : public Allocator
+        {
+        public:
+            void *allocate(std::size_t bytes) override
+            {
+                return system_allocate(bytes);
+            }
+
+            void deallocate(void *ptr, std::size_t) override
+            {
+                system_release(ptr);
+            }
+        };
+
+        // Size-bucketed free lists, one per power of two from 64 bytes, chosen by the requested size alone since
+        // deallocate() is told the size again. Freed blocks are linked through their own first bytes, so recycling a
+        // buffer never allocates; trim() gives the cached blocks back to the system.
+        class PoolAllocator : public Allocator
+        {
+        public:
+            PoolAllocator() = default;
+
+            PoolAllocator(const PoolAllocator &) = delete;
+
+            PoolAllocator &operator=(const PoolAllocator &) = delete;
+
+            ~PoolAllocator() override
+            {
+                trim();
+            }
+
+            void *allocate(std::size_t bytes) override
+            {
+                const std::size_t bucket = bucket_of(bytes);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    if (free_lists[bucket])
+                    {
+                        FreeBlock *block = free_lists[bucket];
+                        free_lists[bucket] = block->next;
+                        return block;
+                    }
+                }
+
+                return system_allocate(bucket_size(bucket));
+            }
+
+            void deallocate(void *ptr, std::size_t bytes) override
+            {
+                const std::size_t bucket = bucket_of(bytes);
+                std::lock_guard<std::mutex> lock(mutex);
+
+                FreeBlock *block = static_cast<FreeBlock *>(ptr);
+                block->next = free_lists[bucket];
+                free_lists[bucket] = block;
+            }
+
+            void trim()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (FreeBlock *&head: free_lists)
+                {
+                    while (head)
+                    {
+                        FreeBlock *next = head->next;
+                        system_release(head);
+                        head = next;
+                    }
+                }
+            }
+
+        private:
+            struct FreeBlock
+            {
+                FreeBlock *next;
+            };
+
+            static constexpr std::size_t min_shift = 6;
+            static constexpr std::size_t n_buckets = 8 * sizeof(std::size_t) - min_shift;
+
+            static std::size_t bucket_of(std::size_t bytes)
+            {
+                std::size_t bucket = 0;
+                while (bucket_size(bucket) < bytes) ++bucket;
+                return bucket;
+            }
+
+            static std::size_t bucket_size(std::size_t bucket)
+            {
+                return std::size_t(1) << (bucket + min_shift);
+            }
+
+            std::mutex mutex;
+            FreeBlock *free_lists[n_buckets] = {};
+        };
+
+        namespace detail
+        {
+            inline std::atomic<Allocator *> &current()
+            {
+                static HeapAllocator heap;
+                static std::atomic<Allocator *> instance{&heap};
+                return instance;
+            }
+
+            // Blocks outlive the allocator that was current when they were acquired, so replaced allocators are
+            // kept until exit.
+            inline std::vector<std::shared_ptr<Allocator>> &installed()
+            {
+                static std::vector<std::shared_ptr<Allocator>> allocators;
+                return allocators;
+            }
+
+            inline std::mutex &installed_mutex()
+            {
+                static std::mutex mutex;
+                return mutex;
+            }
+        }
+
+        inline void set_allocator(std::shared_ptr<Allocator> allocator)
+        {
+            std::lock_guard<std::mutex> lock(detail::installed_mutex());
+            detail::installed().push_back(allocator);
+            detail::current().store(allocator.get());
+        }
+
+        inline Allocator &get_allocator()
+        {
+            return *detail::current().load();
+        }
+
+        // An owned buffer of bytes from the allocator that was current when it was made. It remembers that
+        // allocator and its size itself, so nothing is stored alongside the bytes and a power-of-two request fills
+        // its bucket exactly.
+        class Block
+        {
+        public:
+            Block() = default;
+
+            // Empty when bytes is 0.
+            explicit Block(std::size_t bytes) : bytes(bytes)
+            {
+                if (bytes == 0)
+                {
+                    return;
+                }
+
+                owner = detail::current().load();
+                ptr = owner->allocate(bytes);
+                detail::counters().acquired.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            Block(const Block &) = delete;
+
+            Block &operator=(const Block &) = delete;
+
+            Block(Block &&other) noexcept
+                    : owner(std::exchange(other.owner, nullptr)), ptr(std::exchange(other.ptr, nullptr)),
+                      bytes(std::exchange(other.bytes, 0))
+            {}
+
+            Block &operator=(Block &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset();
+                    owner = std::exchange(other.owner, nullptr);
+                    ptr = std::exchange(other.ptr, nullptr);
+                    bytes = std::exchange(other.bytes, 0);
+                }
+
+                return *this;
+            }
+
+            ~Block()
+            {
+                reset();
+            }
+
+            void reset()
+            {
+                if (!ptr)
+                {
+                    return;
+                }
+
+                detail::counters().released.fetch_add(1, std::memory_order_relaxed);
+                owner->deallocate(ptr, bytes);
+                owner = nullptr;
+                ptr = nullptr;
+                bytes = 0;
+            }
+
+            template<typename T>
+            T *get() const
+            {
+                return static_cast<T *>(ptr);
+            }
+
+            std::size_t size() const
+            {
+                return bytes;
+            }
+
+            explicit operator bool() const
+            {
+                return ptr != nullptr;
+            }
+
+        private:
+            Allocator *owner = nullptr;
+            void *ptr = nullptr;
+            std::size_t bytes = 0;
+        };
+
+        // Standard allocator over the Allocator that was current when it was made, for std::allocate_shared and
+        // containers. Copies, including the one a shared_ptr control block keeps, give memory back to that same
+        // Allocator, and a container moved into another brings its allocator along, so the move never copies.
+        template<typename T>
+        class StdAllocator
+        {
+        public:
+            typedef T value_type;
+            typedef std::true_type propagate_on_container_move_assignment;
+
+            Allocator *owner;
+
+            StdAllocator() : owner(detail::current().load())
+            {}
+
+            template<typename U>
+            StdAllocator(const StdAllocator<U> &other) : owner(other.owner)
+            {}
+
+            T *allocate(std::size_t n)
+            {
+                detail::counters().acquired.fetch_add(1, std::memory_order_relaxed);
+                return static_cast<T *>(owner->allocate(n * sizeof(T)));
+            }
+
+            void deallocate(T *ptr, std::size_t n)
+            {
+                detail::counters().released.fetch_add(1, std::memory_order_relaxed);
+                owner->deallocate(ptr, n * sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(const StdAllocator<U> &other) const
+            {
+                return owner == other.owner;
+            }
+
+            template<typename U>
+            bool operator!=(const StdAllocator<U> &other) const
+            {
+                return owner != other.owner;
+            }
+        };
+
+        inline Stats stats()
+        {
+            const detail::Counters &counters = detail::counters();
+
+            Stats out;
+            out.system_allocations = counters.system_allocations.load(std::memory_order_relaxed);
+            out.system_releases = counters.system_releases.load(std::memory_order_relaxed);
+            out.acquired = counters.acquired.load(std::memory_order_relaxed);
+            out.released = counters.released.load(std::memory_order_relaxed);
+            return out;
+        }
+    }
+}
+
+#endif // MEMORY_HPP
\ No newline at end of file
@@ -2,417 +2,1212 @@
 #define OPERATORS_HPP
 
 #include "tensor.hpp"
+#include "grad_mode.hpp"
 #include "autograd.hpp"
+#include "tape.hpp"
+#include "broadcast.hpp"
+#include "reduction.hpp"
+#include "activation.hpp"
+#include <cmath>
+#include <initializer_list>
+#include <utility>
 
 namespace Malphax
 {
-    inline Tensor operator+(const Tensor &A, const Tensor &B)
+    namespace autograd
     {
-        auto result_impl = std::make_shared<TensorImpl>();
-        result_impl->n_rows = A.n_rows();
-        result_impl->n_cols = A.n_cols();
-        result_impl->data = A.data() + B.data();
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        // Element-wise operators broadcast batches through their data, which holds the slices side by side. That
+        // only lines up when both operands have as many slices and, across several, as many columns; rows still
+        // broadcast without a copy.
+        template<typename eT>
+        bool batch_aligned(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
+        {
+            return A.n_slices() == B.n_slices() && (A.n_slices() == 1 || A.n_cols() == B.n_cols());
+        }
 
-        if (A.requires_grad() || B.requires_grad())
+        // Expands whichever operand broadcasts along the columns or slices, so that batch_aligned() holds.
+        template<typename eT>
+        std::pair<BasicTensor<eT>, BasicTensor<eT>> align_batches(const BasicTensor<eT> &A, const BasicTensor<eT> &B,
+                                                                  const char *op)
         {
-            result_impl->requires_grad = true;
+            broadcast::extent(A.n_rows(), B.n_rows(), op);
+            const unsigned long long n_cols = broadcast::extent(A.n_cols(), B.n_cols(), op);
+            const unsigned long long n_slices = broadcast::extent(A.n_slices(), B.n_slices(), op);
 
-            result_impl->grad_fn = std::make_shared<autograd::Add_>(
-                    const_cast<Tensor *>(&A),
-                    const_cast<Tensor *>(&B),
-                    result_impl
-            );
+            return {A.n_cols() == n_cols && A.n_slices() == n_slices ? A : expand(A, A.n_rows(), n_cols, n_slices),
+                    B.n_cols() == n_cols && B.n_slices() == n_slices ? B : expand(B, B.n_rows(), n_cols, n_slices)};
         }
 
-        return Tensor(result_impl);
+        // Throws unless every element of M is positive. Called before an operator records its result or node, and
+        // kept branch-free so the scan vectorizes; the log itself then runs unchecked.
+        template<typename eT>
+        void check_log_domain(const arma::Mat<eT> &M)
+        {
+            const eT *x = M.memptr();
+            bool outside = false;
+
+            for (arma::uword k = 0; k < M.n_elem; ++k) outside |= x[k] <= eT(0);
+
+            if (outside)
+            {
+                throw std::runtime_error("Log of zero or negative value");
+            }
+        }
     }
 
-    inline Tensor operator-(const Tensor &A, const Tensor &B)
+    template<typename eT>
+    BasicTensor<eT> operator+(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
     {
-        auto result_impl = std::make_shared<TensorImpl>();
-        result_impl->n_rows = A.n_rows();
-        result_impl->n_cols = A.n_cols();
-        result_impl->data = A.data() - B.data();
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        if (!autograd::batch_aligned(A, B))
+        {
+            const auto operands = autograd::align_batches(A, B, "Addition");
+            return operands.first + operands.second;
+        }
+
+        auto result_impl = autograd::make_result<eT>();
+
+        if (broadcast::same_shape(A.data(), B.data()))
+        {
+            result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() + B.data();
+        }
+        else
+        {
+            const auto shape = broadcast::shape(A.data(), B.data(), "Addition");
+            broadcast::apply(result_impl->allocate_data(shape.first, shape.second), A.data(), B.data(),
+                             [](eT a, eT b) { return a + b; });
+        }
+
+        result_impl->n_slices = A.n_slices();
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
 
-        if (A.requires_grad() || B.requires_grad())
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Sub_>(
-                    const_cast<Tensor *>(&A),
-                    const_cast<Tensor *>(&B),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::Add_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor operator*(const Tensor &A, const Tensor &B)
+    template<typename eT>
+    BasicTensor<eT> operator-(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
     {
-        if ((A.n_rows() != B.n_rows() || A.n_cols() != B.n_cols()) &&
-            (A.data().size() != 1 && B.data().size() != 1))
+        if (!autograd::batch_aligned(A, B))
         {
-            throw std::runtime_error("Element-wise multiplication requires tensors of the same shape");
+            const auto operands = autograd::align_batches(A, B, "Subtraction");
+            return operands.first - operands.second;
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
-        result_impl->n_rows = B.data().size() == 1 ? A.n_rows() : B.n_rows();
-        result_impl->n_cols = B.data().size() == 1 ? A.n_cols() : B.n_cols();
+        auto result_impl = autograd::make_result<eT>();
 
-        if (A.data().size() != 1 && B.data().size() != 1)
+        if (broadcast::same_shape(A.data(), B.data()))
         {
-            result_impl->data = A.data() % B.data();
+            result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() - B.data();
         }
-        else if (A.data().size() == 1)
+        else
         {
-            result_impl->data = A.data()(0, 0) * B.data();
+            const auto shape = broadcast::shape(A.data(), B.data(), "Subtraction");
+            broadcast::apply(result_impl->allocate_data(shape.first, shape.second), A.data(), B.data(),
+                             [](eT a, eT b) { return a - b; });
         }
-        else if (B.data().size() == 1)
+
+        result_impl->n_slices = A.n_slices();
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
-            result_impl->data = A.data() * B.data()(0, 0);
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Sub_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get()
+            );
         }
 
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        return BasicTensor<eT>(result_impl);
+    }
 
-        if (A.requires_grad() || B.requires_grad())
+    template<typename eT>
+    BasicTensor<eT> operator*(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        if (!autograd::batch_aligned(A, B))
+        {
+            const auto operands = autograd::align_batches(A, B, "Element-wise multiplication");
+            return operands.first * operands.second;
+        }
+
+        auto result_impl = autograd::make_result<eT>();
+
+        if (broadcast::same_shape(A.data(), B.data()))
+        {
+            result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() % B.data();
+        }
+        else
+        {
+            const auto shape = broadcast::shape(A.data(), B.data(), "Element-wise multiplication");
+            broadcast::apply(result_impl->allocate_data(shape.first, shape.second), A.data(), B.data(),
+                             [](eT a, eT b) { return a * b; });
+        }
+
+        result_impl->n_slices = A.n_slices();
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Dot_>(
-                    const_cast<Tensor *>(&A),
-                    const_cast<Tensor *>(&B),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::Dot_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor operator*(const Tensor &A, const double &B)
+    template<typename eT>
+    BasicTensor<eT> operator*(const BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B)
     {
-        auto result_impl = std::make_shared<TensorImpl>();
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = A.n_rows();
         result_impl->n_cols = A.n_cols();
-        result_impl->data = A.data() * B;
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() * B;
 
-        if (A.requires_grad())
+        if (GradMode::is_enabled() && A.requires_grad())
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::ScalarDot_>(
-                    const_cast<Tensor *>(&A),
+            result_impl->grad_fn = autograd::make_node<autograd::ScalarDot_<eT>>(
+                    A.get_impl(),
                     B,
-                    result_impl
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor operator*(const double &A, const Tensor &B)
+    template<typename eT>
+    BasicTensor<eT> operator*(const typename BasicTensor<eT>::elem_type &A, const BasicTensor<eT> &B)
     {
         return B * A;
     }
 
-    inline Tensor operator/(const Tensor &A, const Tensor &B)
+    template<typename eT>
+    BasicTensor<eT> operator/(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
     {
-        if ((A.n_rows() != B.n_rows() || A.n_cols() != B.n_cols()) &&
-            (A.data().size() != 1 && B.data().size() != 1))
+        if (!autograd::batch_aligned(A, B))
         {
-            throw std::runtime_error("Element-wise division requires tensors of the same shape");
+            const auto operands = autograd::align_batches(A, B, "Element-wise division");
+            return operands.first / operands.second;
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
-        result_impl->n_rows = B.data().size() == 1 ? A.n_rows() : B.n_rows();
-        result_impl->n_cols = B.data().size() == 1 ? A.n_cols() : B.n_cols();
+        auto result_impl = autograd::make_result<eT>();
 
-        if (A.data().size() != 1 && B.data().size() != 1)
-        {
-            result_impl->data = A.data() / B.data();
-        }
-        else if (A.data().size() == 1)
+        if (broadcast::same_shape(A.data(), B.data()))
         {
-            result_impl->data = A.data()(0, 0) / B.data();
+            result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() / B.data();
         }
-        else if (B.data().size() == 1)
+        else
         {
-            result_impl->data = A.data() / B.data()(0, 0);
+            const auto shape = broadcast::shape(A.data(), B.data(), "Element-wise division");
+            broadcast::apply(result_impl->allocate_data(shape.first, shape.second), A.data(), B.data(),
+                             [](eT a, eT b) { return a / b; });
         }
 
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
 
-        if (A.requires_grad() || B.requires_grad())
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Div_>(
-                    const_cast<Tensor *>(&A),
-                    const_cast<Tensor *>(&B),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::Div_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor operator/(const Tensor &A, const double &B)
+    template<typename eT>
+    BasicTensor<eT> operator/(const BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B)
     {
         if (B == 0.0)
         {
             throw std::runtime_error("Division by zero");
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = A.n_rows();
         result_impl->n_cols = A.n_cols();
-        result_impl->data = A.data() / B;
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() / B;
 
-        if (A.requires_grad())
+        if (GradMode::is_enabled() && A.requires_grad())
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::ScalarDiv_>(
-                    const_cast<Tensor *>(&A),
+            result_impl->grad_fn = autograd::make_node<autograd::ScalarDiv_<eT>>(
+                    A.get_impl(),
                     B,
-                    result_impl,
+                    result_impl.get(),
                     true
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor operator/(const double &A, const Tensor &B)
+    template<typename eT>
+    BasicTensor<eT> operator/(const typename BasicTensor<eT>::elem_type &A, const BasicTensor<eT> &B)
     {
         if (arma::any(arma::vectorise(B.data()) == 0.0))
         {
             throw std::runtime_error("Division by zero in tensor elements");
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = B.n_rows();
         result_impl->n_cols = B.n_cols();
-        result_impl->data = A / B.data();
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = B.n_slices();
+        result_impl->allocate_data(B.data().n_rows, B.data().n_cols) = A / B.data();
 
-        if (B.requires_grad())
+        if (GradMode::is_enabled() && B.requires_grad())
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::ScalarDiv_>(
-                    const_cast<Tensor *>(&B),
+            result_impl->grad_fn = autograd::make_node<autograd::ScalarDiv_<eT>>(
+                    B.get_impl(),
                     A,
-                    result_impl,
+                    result_impl.get(),
                     false
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> matmul(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        return matmul(A, B, false, false);
     }
 
-    inline Tensor matmul(const Tensor &A, const Tensor &B)
+    // op(A) * op(B), op transposing where asked. The transposes are BLAS flags, so matmul(x, W, false, true)
+    // multiplies by W^T without materializing it, forward or backward.
+    template<typename eT>
+    BasicTensor<eT> matmul(const BasicTensor<eT> &A, const BasicTensor<eT> &B, bool trans_A, bool trans_B)
     {
-        if (A.n_cols() != B.n_rows())
+        if (A.n_slices() != 1 || B.n_slices() != 1)
+        {
+            throw std::runtime_error("matmul() takes matrices; use bmm() for batches");
+        }
+
+        const unsigned long long n_rows = trans_A ? A.n_cols() : A.n_rows();
+        const unsigned long long n_inner = trans_A ? A.n_rows() : A.n_cols();
+
+        if (n_inner != (trans_B ? B.n_cols() : B.n_rows()))
         {
             throw std::runtime_error("Matrix multiplication dimension mismatch");
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
-        result_impl->n_rows = A.n_rows();
-        result_impl->n_cols = B.n_cols();
-        result_impl->data = A.data() * B.data();
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = n_rows;
+        result_impl->n_cols = trans_B ? B.n_rows() : B.n_cols();
+        result_impl->allocate_data(result_impl->n_rows, result_impl->n_cols);
+        kernels::gemm(result_impl->data, true, A.data(), trans_A, B.data(), trans_B);
 
-        if (A.requires_grad() || B.requires_grad())
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::MatMul_>(
-                    const_cast<Tensor *>(&A),
-                    const_cast<Tensor *>(&B),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::MatMul_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get(),
+                    trans_A,
+                    trans_B
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor dot(const Tensor &A, const Tensor &B)
+    template<typename eT>
+    BasicTensor<eT> dot(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
     {
-        if (A.n_rows() != B.n_rows() || A.n_cols() != B.n_cols())
+        if (A.n_rows() != B.n_rows() || A.n_cols() != B.n_cols() || A.n_slices() != B.n_slices())
         {
             throw std::runtime_error("Element-wise multiplication requires tensors of the same shape");
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = A.n_rows();
         result_impl->n_cols = A.n_cols();
-        result_impl->data = A.data() % B.data();
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = A.data() % B.data();
 
-        if (A.requires_grad() || B.requires_grad())
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Dot_>(
-                    const_cast<Tensor *>(&A),
-                    const_cast<Tensor *>(&B),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::Dot_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor sum(const Tensor &A, unsigned long long dim)
+    template<typename eT>
+    BasicTensor<eT> sum(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims)
     {
-        if (dim > 1)
+        const reduction::Axes axes = reduction::axes(dims, A.n_slices());
+
+        auto result_impl = autograd::make_result<eT>();
+        reduction::sum(result_impl->allocate_data(reduction::reduced_rows(A.data().n_rows, axes),
+                                                  reduction::reduced_cols(A.data().n_cols, axes)), A.data(), axes);
+        result_impl->n_slices = reduction::reduced_slices(axes);
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            throw std::runtime_error("Dimension must be either 0 (rows) or 1 (columns)");
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Sum_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    axes
+            );
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
+        return BasicTensor<eT>(result_impl);
+    }
 
-        if (dim == 0)
+    template<typename eT>
+    BasicTensor<eT> sum(const BasicTensor<eT> &A)
+    {
+        return sum(A, {0, 1, 2});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> sum(const BasicTensor<eT> &A, unsigned long long dim)
+    {
+        return sum(A, {dim});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> mean(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims)
+    {
+        const reduction::Axes axes = reduction::axes(dims, A.n_slices());
+
+        auto result_impl = autograd::make_result<eT>();
+        reduction::mean(result_impl->allocate_data(reduction::reduced_rows(A.data().n_rows, axes),
+                                                   reduction::reduced_cols(A.data().n_cols, axes)), A.data(), axes);
+        result_impl->n_slices = reduction::reduced_slices(axes);
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            result_impl->data = arma::sum(A.data(), 0);
-            result_impl->n_rows = 1;
-            result_impl->n_cols = A.n_cols();
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Mean_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    axes
+            );
         }
-        else
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> mean(const BasicTensor<eT> &A)
+    {
+        return mean(A, {0, 1, 2});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> mean(const BasicTensor<eT> &A, unsigned long long dim)
+    {
+        return mean(A, {dim});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> max(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims)
+    {
+        const reduction::Axes axes = reduction::axes(dims, A.n_slices());
+
+        auto result_impl = autograd::make_result<eT>();
+        arma::uvec index;
+        reduction::extremum(result_impl->allocate_data(reduction::reduced_rows(A.data().n_rows, axes),
+                                                       reduction::reduced_cols(A.data().n_cols, axes)),
+                            A.data(), axes, index, [](eT a, eT b) { return a > b; });
+        result_impl->n_slices = reduction::reduced_slices(axes);
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            result_impl->data = arma::sum(A.data(), 1);
-            result_impl->n_rows = A.n_rows();
-            result_impl->n_cols = 1;
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Extremum_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    std::move(index)
+            );
         }
 
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> max(const BasicTensor<eT> &A)
+    {
+        return max(A, {0, 1, 2});
+    }
 
-        if (A.requires_grad())
+    template<typename eT>
+    BasicTensor<eT> max(const BasicTensor<eT> &A, unsigned long long dim)
+    {
+        return max(A, {dim});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> min(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims)
+    {
+        const reduction::Axes axes = reduction::axes(dims, A.n_slices());
+
+        auto result_impl = autograd::make_result<eT>();
+        arma::uvec index;
+        reduction::extremum(result_impl->allocate_data(reduction::reduced_rows(A.data().n_rows, axes),
+                                                       reduction::reduced_cols(A.data().n_cols, axes)),
+                            A.data(), axes, index, [](eT a, eT b) { return a < b; });
+        result_impl->n_slices = reduction::reduced_slices(axes);
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Sum_>(
-                    const_cast<Tensor *>(&A),
-                    result_impl,
-                    dim
+            result_impl->grad_fn = autograd::make_node<autograd::Extremum_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    std::move(index)
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> min(const BasicTensor<eT> &A)
+    {
+        return min(A, {0, 1, 2});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> min(const BasicTensor<eT> &A, unsigned long long dim)
+    {
+        return min(A, {dim});
     }
 
-    inline Tensor mean(const Tensor &A, unsigned long long dim)
+    template<typename eT>
+    BasicTensor<eT> logsumexp(const BasicTensor<eT> &A, std::initializer_list<unsigned long long> dims)
     {
-        if (dim > 1)
+        const reduction::Axes axes = reduction::axes(dims, A.n_slices());
+
+        auto result_impl = autograd::make_result<eT>();
+        reduction::logsumexp(result_impl->allocate_data(reduction::reduced_rows(A.data().n_rows, axes),
+                                                        reduction::reduced_cols(A.data().n_cols, axes)),
+                             A.data(), axes);
+        result_impl->n_slices = reduction::reduced_slices(axes);
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = result_impl->data.n_cols / result_impl->n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            throw std::runtime_error("Dimension must be either 0 (rows) or 1 (columns)");
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::LogSumExp_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    axes
+            );
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
+        return BasicTensor<eT>(result_impl);
+    }
 
-        if (dim == 0)
+    template<typename eT>
+    BasicTensor<eT> logsumexp(const BasicTensor<eT> &A)
+    {
+        return logsumexp(A, {0, 1, 2});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> logsumexp(const BasicTensor<eT> &A, unsigned long long dim)
+    {
+        return logsumexp(A, {dim});
+    }
+
+    template<typename eT>
+    BasicTensor<eT> exp(const BasicTensor<eT> &A)
+    {
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = A.n_rows();
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = arma::exp(A.data());
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            result_impl->data = arma::mean(A.data(), 0);
-            result_impl->n_rows = 1;
-            result_impl->n_cols = A.n_cols();
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Exp_<eT>>(
+                    A.get_impl(),
+                    result_impl.get()
+            );
         }
-        else
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> log(const BasicTensor<eT> &A)
+    {
+        autograd::check_log_domain(A.data());
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = A.n_rows();
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = arma::log(A.data());
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            result_impl->data = arma::mean(A.data(), 1);
-            result_impl->n_rows = A.n_rows();
-            result_impl->n_cols = 1;
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Log_<eT>>(
+                    A.get_impl(),
+                    result_impl.get()
+            );
         }
 
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        return BasicTensor<eT>(result_impl);
+    }
 
-        if (A.requires_grad())
+    template<typename eT>
+    BasicTensor<eT> abs(const BasicTensor<eT> &A)
+    {
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = A.n_rows();
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols) = arma::abs(A.data());
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Mean_>(
-                    const_cast<Tensor *>(&A),
-                    result_impl,
-                    dim
+            result_impl->grad_fn = autograd::make_node<autograd::Abs_<eT>>(
+                    A.get_impl(),
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor exp(const Tensor &A)
+    // The node keeps a bit per element rather than the input.
+    template<typename eT>
+    BasicTensor<eT> relu(const BasicTensor<eT> &A)
     {
-        auto result_impl = std::make_shared<TensorImpl>();
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = A.n_rows();
         result_impl->n_cols = A.n_cols();
-        result_impl->data = arma::exp(A.data());
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols);
+
+        const bool requires_grad = GradMode::is_enabled() && A.requires_grad();
+        const eT *x = A.data().memptr();
+        eT *y = result_impl->data.memptr();
+        const arma::uword n_elem = A.data().n_elem;
+        kernels::BitMask mask(requires_grad ? n_elem : 0);
+
+        if (requires_grad)
+        {
+            for (arma::uword k = 0; k < n_elem; ++k)
+            {
+                if (x[k] > eT(0))
+                {
+                    y[k] = x[k];
+                    mask.set(k);
+                }
+                else
+                {
+                    y[k] = eT(0);
+                }
+            }
+        }
+        else
+        {
+            for (arma::uword k = 0; k < n_elem; ++k) y[k] = x[k] > eT(0) ? x[k] : eT(0);
+        }
 
-        if (A.requires_grad())
+        if (requires_grad)
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Exp_>(
-                    const_cast<Tensor *>(&A),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::ReLU_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    std::move(mask)
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor log(const Tensor &A)
+    template<typename eT>
+    BasicTensor<eT> sigmoid(const BasicTensor<eT> &A)
     {
-        if (arma::any(arma::vectorise(A.data()) <= 0.0))
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = A.n_rows();
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols);
+
+        const eT *x = A.data().memptr();
+        eT *y = result_impl->data.memptr();
+
+        for (arma::uword k = 0; k < A.data().n_elem; ++k) y[k] = eT(1) / (eT(1) + std::exp(-x[k]));
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
-            throw std::runtime_error("Log of zero or negative value");
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Sigmoid_<eT>>(
+                    A.get_impl(),
+                    result_impl.get()
+            );
         }
 
-        auto result_impl = std::make_shared<TensorImpl>();
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> tanh(const BasicTensor<eT> &A)
+    {
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = A.n_rows();
         result_impl->n_cols = A.n_cols();
-        result_impl->data = arma::log(A.data());
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols);
 
-        if (A.requires_grad())
+        const eT *x = A.data().memptr();
+        eT *y = result_impl->data.memptr();
+
+        for (arma::uword k = 0; k < A.data().n_elem; ++k) y[k] = std::tanh(x[k]);
+
+        if (GradMode::is_enabled() && A.requires_grad())
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Log_>(
-                    const_cast<Tensor *>(&A),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::Tanh_<eT>>(
+                    A.get_impl(),
+                    result_impl.get()
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
     }
 
-    inline Tensor abs(const Tensor &A)
+    // x * Phi(x), with the exact normal CDF.
+    template<typename eT>
+    BasicTensor<eT> gelu(const BasicTensor<eT> &A)
     {
-        auto result_impl = std::make_shared<TensorImpl>();
+        auto result_impl = autograd::make_result<eT>();
         result_impl->n_rows = A.n_rows();
         result_impl->n_cols = A.n_cols();
-        result_impl->data = arma::abs(A.data());
-        result_impl->grad = arma::zeros(result_impl->n_rows, result_impl->n_cols);
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols);
+
+        const eT *x = A.data().memptr();
+        eT *y = result_impl->data.memptr();
+
+        for (arma::uword k = 0; k < A.data().n_elem; ++k) y[k] = activation::apply(Activation::GELU, x[k]);
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::GELU_<eT>>(
+                    A.get_impl(),
+                    result_impl.get()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // A row or column vector is transposed as a view of its storage; anything else is copied, since a column-major
+    // matrix has no transposed layout to share. Pass transposes to matmul() as flags instead where possible.
+    template<typename eT>
+    BasicTensor<eT> t(const BasicTensor<eT> &A)
+    {
+        if (A.n_slices() != 1)
+        {
+            throw std::runtime_error("t() takes a matrix; pass transposes to bmm() as flags for batches");
+        }
+
+        const auto A_impl = A.get_impl();
+        std::shared_ptr<BasicTensorImpl<eT>> result_impl;
+
+        if (A.n_rows() == 1 || A.n_cols() == 1)
+        {
+            result_impl = autograd::make_result<eT>(A_impl, A_impl->data.memptr(), A.n_cols(), A.n_rows());
+        }
+        else
+        {
+            result_impl = autograd::make_result<eT>();
+            result_impl->allocate_data(A.data().n_cols, A.data().n_rows) = A.data().t();
+            result_impl->n_rows = result_impl->data.n_rows;
+            result_impl->n_cols = result_impl->data.n_cols;
+        }
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Transpose_<eT>>(
+                    A_impl,
+                    result_impl.get()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // Rows first_row..last_row are strided in column-major storage, and an Armadillo matrix cannot describe a strided
+    // view, so unlike cols() they are copied. Taken from every slice of a batch.
+    //
+    // To draw mini-batches without copying, keep a dataset sample-major, one sample per column (features x samples),
+    // and take batches with cols(), which share the dataset's storage. matmul(batch, W, true, false) then computes
+    // batch^T * W, samples x outputs, with the transpose passed to BLAS as a flag in both passes:
+    //
+    //     auto batch = cols(X, first, first + batch_size - 1);
+    //     auto y = matmul(batch, W, true, false);
+    template<typename eT>
+    BasicTensor<eT> rows(const BasicTensor<eT> &A, unsigned long long first_row, unsigned long long last_row)
+    {
+        if (first_row > last_row || last_row >= A.n_rows())
+        {
+            throw std::runtime_error("Row range out of bounds");
+        }
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->allocate_data(last_row - first_row + 1, A.data().n_cols) = A.data().rows(first_row, last_row);
+        result_impl->n_rows = result_impl->data.n_rows;
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Slice_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    first_row,
+                    0
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // Columns first_col..last_col, sharing A's storage.
+    template<typename eT>
+    BasicTensor<eT> cols(const BasicTensor<eT> &A, unsigned long long first_col, unsigned long long last_col)
+    {
+        if (A.n_slices() != 1)
+        {
+            throw std::runtime_error("cols() takes a matrix; use slices() for batches");
+        }
+
+        if (first_col > last_col || last_col >= A.n_cols())
+        {
+            throw std::runtime_error("Column range out of bounds");
+        }
+
+        const auto A_impl = A.get_impl();
+        auto result_impl = autograd::make_result<eT>(A_impl, A_impl->data.colptr(first_col), A.n_rows(),
+                                                     last_col - first_col + 1);
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Slice_<eT>>(
+                    A_impl,
+                    result_impl.get(),
+                    0,
+                    first_col
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // The same elements in the same column-major order, sharing A's storage.
+    template<typename eT>
+    BasicTensor<eT> reshape(const BasicTensor<eT> &A, unsigned long long n_rows, unsigned long long n_cols)
+    {
+        return reshape(A, n_rows, n_cols, 1);
+    }
+
+    // Slices lie side by side in storage, so reshape(X, r, c * s) flattens a batch and reshape(X, r, c, s) splits
+    // one up.
+    template<typename eT>
+    BasicTensor<eT> reshape(const BasicTensor<eT> &A, unsigned long long n_rows, unsigned long long n_cols,
+                            unsigned long long n_slices)
+    {
+        if (n_rows * n_cols * n_slices != A.data().n_elem)
+        {
+            throw std::runtime_error("Reshape requires the same number of elements");
+        }
+
+        const auto A_impl = A.get_impl();
+        auto result_impl = autograd::make_result<eT>(A_impl, A_impl->data.memptr(), n_rows, n_cols * n_slices);
+        result_impl->n_cols = n_cols;
+        result_impl->n_slices = n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Reshape_<eT>>(
+                    A_impl,
+                    result_impl.get()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // Slices first_slice..last_slice of a batch, sharing A's storage.
+    template<typename eT>
+    BasicTensor<eT> slices(const BasicTensor<eT> &A, unsigned long long first_slice, unsigned long long last_slice)
+    {
+        if (first_slice > last_slice || last_slice >= A.n_slices())
+        {
+            throw std::runtime_error("Slice range out of bounds");
+        }
+
+        const auto A_impl = A.get_impl();
+        const unsigned long long n_slices = last_slice - first_slice + 1;
+        auto result_impl = autograd::make_result<eT>(A_impl, A_impl->data.colptr(first_slice * A.n_cols()),
+                                                     A.n_rows(), A.n_cols() * n_slices);
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = n_slices;
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Slice_<eT>>(
+                    A_impl,
+                    result_impl.get(),
+                    0,
+                    first_slice * A.n_cols()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // Repeats the size-1 rows, columns or slices of A up to the given shape. The copies are real, so prefer
+    // leaving the broadcasting to the element-wise operators, which only expand what their data cannot broadcast.
+    template<typename eT>
+    BasicTensor<eT> expand(const BasicTensor<eT> &A, unsigned long long n_rows, unsigned long long n_cols,
+                           unsigned long long n_slices)
+    {
+        if ((A.n_rows() != n_rows && A.n_rows() != 1) || (A.n_cols() != n_cols && A.n_cols() != 1) ||
+            (A.n_slices() != n_slices && A.n_slices() != 1))
+        {
+            throw std::runtime_error("Only axes of size 1 can be expanded");
+        }
+
+        const auto A_impl = A.get_impl();
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = n_rows;
+        result_impl->n_cols = n_cols;
+        result_impl->n_slices = n_slices;
+        result_impl->allocate_data(n_rows, n_cols * n_slices);
+
+        const eT *a = A_impl->data.memptr();
+        eT *out = result_impl->data.memptr();
+        autograd::Expand_<eT>::for_each_source(*A_impl, *result_impl, [&](arma::uword k, arma::uword src)
+        { out[k] = a[src]; });
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Expand_<eT>>(
+                    A_impl,
+                    result_impl.get()
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    template<typename eT>
+    BasicTensor<eT> bmm(const BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        return bmm(A, B, false, false);
+    }
+
+    // op(A_k) * op(B_k) for every slice k, recorded as a single node. Either operand may have one slice, which is
+    // then shared by the batch, e.g. a weight applied to every sample.
+    template<typename eT>
+    BasicTensor<eT> bmm(const BasicTensor<eT> &A, const BasicTensor<eT> &B, bool trans_A, bool trans_B)
+    {
+        const unsigned long long n_rows = trans_A ? A.n_cols() : A.n_rows();
+        const unsigned long long n_inner = trans_A ? A.n_rows() : A.n_cols();
+
+        if (n_inner != (trans_B ? B.n_cols() : B.n_rows()))
+        {
+            throw std::runtime_error("Matrix multiplication dimension mismatch");
+        }
+
+        const unsigned long long n_slices = broadcast::extent(A.n_slices(), B.n_slices(),
+                                                              "Batched matrix multiplication");
 
-        if (A.requires_grad())
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = n_rows;
+        result_impl->n_cols = trans_B ? B.n_rows() : B.n_cols();
+        result_impl->n_slices = n_slices;
+        result_impl->allocate_data(result_impl->n_rows, result_impl->n_cols * n_slices);
+
+        for (arma::uword k = 0; k < n_slices; ++k)
+        {
+            arma::Mat<eT> dst = kernels::slice(result_impl->data, n_slices, k);
+            kernels::gemm(dst, true, kernels::slice(A.data(), A.n_slices(), k), trans_A,
+                          kernels::slice(B.data(), B.n_slices(), k), trans_B);
+        }
+
+        if (GradMode::is_enabled() && (A.requires_grad() || B.requires_grad()))
         {
             result_impl->requires_grad = true;
 
-            result_impl->grad_fn = std::make_shared<autograd::Abs_>(
-                    const_cast<Tensor *>(&A),
-                    result_impl
+            result_impl->grad_fn = autograd::make_node<autograd::BatchMatMul_<eT>>(
+                    A.get_impl(),
+                    B.get_impl(),
+                    result_impl.get(),
+                    trans_A,
+                    trans_B
             );
         }
 
-        return Tensor(result_impl);
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // In-place operators modify A's storage and return A. While grad is recorded the operation is chained behind
+    // A's grad_fn; backward() then throws if something it reads back was overwritten by a later in-place operator.
+    template<typename eT>
+    BasicTensor<eT> &add_(BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        const auto A_impl = A.get_impl();
+        const auto B_impl = B.get_impl();
+        const bool record = autograd::prepare_in_place(*A_impl, B_impl.get(), "add_");
+
+        autograd::update_in_place(*A_impl, *B_impl, [](eT a, eT b) { return a + b; });
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::AddInPlace_<eT>>(A_impl.get(), B_impl, eT(1));
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
+
+    template<typename eT>
+    BasicTensor<eT> &sub_(BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        const auto A_impl = A.get_impl();
+        const auto B_impl = B.get_impl();
+        const bool record = autograd::prepare_in_place(*A_impl, B_impl.get(), "sub_");
+
+        autograd::update_in_place(*A_impl, *B_impl, [](eT a, eT b) { return a - b; });
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::AddInPlace_<eT>>(A_impl.get(), B_impl, eT(-1));
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
+
+    template<typename eT>
+    BasicTensor<eT> &mul_(BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        const auto A_impl = A.get_impl();
+        const auto B_impl = B.get_impl();
+        const bool record = autograd::prepare_in_place(*A_impl, B_impl.get(), "mul_");
+
+        // dB needs A's old value, which is about to be overwritten.
+        arma::Mat<eT> original;
+        if (record && B_impl->requires_grad) original = A_impl->data;
+
+        autograd::update_in_place(*A_impl, *B_impl, [](eT a, eT b) { return a * b; });
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::MulInPlace_<eT>>(A_impl.get(), B_impl,
+                                                                              std::move(original));
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
+
+    template<typename eT>
+    BasicTensor<eT> &mul_(BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B)
+    {
+        const auto A_impl = A.get_impl();
+        const bool record = autograd::prepare_in_place<eT>(*A_impl, nullptr, "mul_");
+
+        A_impl->data *= B;
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::ScalarMulInPlace_<eT>>(A_impl.get(), B);
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
+
+    template<typename eT>
+    BasicTensor<eT> &div_(BasicTensor<eT> &A, const BasicTensor<eT> &B)
+    {
+        const auto A_impl = A.get_impl();
+        const auto B_impl = B.get_impl();
+        const bool record = autograd::prepare_in_place(*A_impl, B_impl.get(), "div_");
+
+        arma::Mat<eT> original;
+        if (record && B_impl->requires_grad) original = A_impl->data;
+
+        autograd::update_in_place(*A_impl, *B_impl, [](eT a, eT b) { return a / b; });
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::DivInPlace_<eT>>(A_impl.get(), B_impl,
+                                                                              std::move(original));
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
     }
 
+    template<typename eT>
+    BasicTensor<eT> &div_(BasicTensor<eT> &A, const typename BasicTensor<eT>::elem_type &B)
+    {
+        if (B == 0.0)
+        {
+            throw std::runtime_error("Division by zero");
+        }
+
+        const auto A_impl = A.get_impl();
+        const bool record = autograd::prepare_in_place<eT>(*A_impl, nullptr, "div_");
+
+        A_impl->data /= B;
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::ScalarMulInPlace_<eT>>(A_impl.get(), eT(1) / B);
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
+
+    template<typename eT>
+    BasicTensor<eT> &exp_(BasicTensor<eT> &A)
+    {
+        const auto A_impl = A.get_impl();
+        const bool record = autograd::prepare_in_place<eT>(*A_impl, nullptr, "exp_");
+
+        A_impl->data = arma::exp(A_impl->data);
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::ExpInPlace_<eT>>(A_impl.get());
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
+
+    template<typename eT>
+    BasicTensor<eT> &log_(BasicTensor<eT> &A)
+    {
+        autograd::check_log_domain(A.data());
+
+        const auto A_impl = A.get_impl();
+        const bool record = autograd::prepare_in_place<eT>(*A_impl, nullptr, "log_");
+
+        A_impl->data = arma::log(A_impl->data);
+        ++*A_impl->version_counter;
+
+        if (record)
+        {
+            A_impl->grad_fn = autograd::make_node<autograd::LogInPlace_<eT>>(A_impl.get());
+            A_impl->requires_grad = true;
+            A_impl->history_version = *A_impl->version_counter;
+        }
+
+        return A;
+    }
 }
 
 #endif // OPERATORS_HPP
\ No newline at end of file
@@ -0,0 +1,294 @@
+#ifndef OPTIM_HPP
+#define OPTIM_HPP
+
+#include "base.hpp"
+#include "tensor.hpp"
+#include "engine.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <armadillo>
+
+namespace Malphax
+{
+    namespace optim
+    {
+        // The parameters are numbered into one flat range of elements, and the optimizer's per-element state (momenta,
+        // second moments) lives in the columns of a single matrix over that range. A step cuts the range into a few
+        // large chunks, each running the update kernel across whichever tensors it covers, on the backward pool when
+        // one is set; hundreds of small tensors cost about as much as one tensor of their total size.
+        template<typename eT>
+        class BasicOptimizer
+        {
+        public:
+            BasicOptimizer(const std::vector<BasicTensor<eT>> &parameters, arma::uword n_states)
+            {
+                offsets.push_back(0);
+
+                for (const auto &parameter: parameters)
+                {
+                    handles.push_back(parameter);
+                    params.push_back(parameter.get_impl());
+                    offsets.push_back(offsets.back() + parameter.data().n_elem);
+                }
+
+                state.zeros(offsets.back(), n_states);
+                data_ptrs.resize(params.size());
+                grad_ptrs.resize(params.size());
+            }
+
+            BasicOptimizer(const BasicOptimizer &) = delete;
+
+            BasicOptimizer &operator=(const BasicOptimizer &) = delete;
+
+            virtual ~BasicOptimizer() = default;
+
+            // Updates every parameter that requires grad and has a gradient. Frozen parameters and those that
+            // received none since their gradient was last cleared are left alone, state included.
+            virtual void step() = 0;
+
+            void zero_grad(bool release = true)
+            {
+                for (const auto &impl: params)
+                {
+                    impl->zero_grad(release);
+                }
+            }
+
+        protected:
+            // Elements per chunk below which a step is not worth handing to the pool.
+            static constexpr arma::uword min_chunk = 1u << 15;
+
+            std::vector<std::shared_ptr<BasicTensorImpl<eT>>> params;
+            // Parameter i covers the elements [offsets[i], offsets[i + 1]) of the flat range.
+            std::vector<arma::uword> offsets;
+            arma::Mat<eT> state;
+
+            // Runs kernel(w, g, offset, n) over every parameter with a gradient, w and g pointing at n elements of
+            // its data and gradient that start at element offset of the flat range (and so of each state column).
+            template<typename F>
+            void update(F kernel)
+            {
+                for (std::size_t i = 0; i < params.size(); ++i)
+                {
+                    BasicTensorImpl<eT> &impl = *params[i];
+
+                    if (impl.data.n_elem != offsets[i + 1] - offsets[i])
+                    {
+                        throw std::runtime_error("A parameter changed size after it was given to the optimizer");
+                    }
+
+                    data_ptrs[i] = impl.data.memptr();
+                    grad_ptrs[i] = impl.requires_grad && impl.has_grad() ? impl.grad.memptr() : nullptr;
+
+                    // Graphs recorded before the step saw the old values.
+                    if (grad_ptrs[i]) ++*impl.version_counter;
+                }
+
+                auto run_chunk = [&](arma::uword first, arma::uword last)
+                {
+                    std::size_t i = std::upper_bound(offsets.begin(), offsets.end(), first) - offsets.begin() - 1;
+
+                    for (; first < last; ++i)
+                    {
+                        arma::uword end = std::min(last, offsets[i + 1]);
+                        const arma::uword begin = first - offsets[i];
+                        const std::size_t head = i;
+
+                        if (end > first && grad_ptrs[i])
+                        {
+                            // Parameters whose data and gradients lie back to back, as a ParameterGroup keeps them,
+                            // run as one span.
+                            while (end < last && contiguous(i))
+                            {
+                                end = std::min(last, offsets[++i + 1]);
+                            }
+
+                            kernel(data_ptrs[head] + begin, grad_ptrs[head] + begin, first, end - first);
+                        }
+
+                        first = end;
+                    }
+                };
+
+                const arma::uword total = offsets.back();
+                std::shared_ptr<ThreadPool> workers;
+
+                if (total >= 2 * min_chunk && !ThreadPool::on_worker_thread())
+                {
+                    workers = autograd::Engine::shared_pool();
+                }
+
+                if (!workers)
+                {
+                    run_chunk(0, total);
+                    return;
+                }
+
+                const arma::uword n_chunks = std::min<arma::uword>(workers->size(), total / min_chunk);
+                arma::uword remaining = n_chunks - 1;
+                std::mutex done_mutex;
+                std::condition_variable done;
+
+                for (arma::uword c = 1; c < n_chunks; ++c)
+                {
+                    workers->submit([&, c]()
+                                    {
+                                        run_chunk(total * c / n_chunks, total * (c + 1) / n_chunks);
+
+                                        std::lock_guard<std::mutex> lock(done_mutex);
+                                        if (--remaining == 0) done.notify_all();
+                                    });
+                }
+
+                run_chunk(0, total / n_chunks);
+
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done.wait(lock, [&remaining]() { return remaining == 0; });
+            }
+
+        private:
+            // Tensor handles keep the parameters' data from being released if the caller lets go of them.
+            std::vector<BasicTensor<eT>> handles;
+            std::vector<eT *> data_ptrs;
+            std::vector<const eT *> grad_ptrs;
+
+            bool contiguous(std::size_t i) const
+            {
+                const arma::uword n = offsets[i + 1] - offsets[i];
+                return grad_ptrs[i + 1] && data_ptrs[i + 1] == data_ptrs[i] + n && grad_ptrs[i + 1] == grad_ptrs[i] + n;
+            }
+        };
+
+        // w -= lr * (g + weight_decay * w), or with momentum v = momentum * v + (g + weight_decay * w) and
+        // w -= lr * v. Momentum is kept only when it is non-zero.
+        template<typename eT>
+        class BasicSGD : public BasicOptimizer<eT>
+        {
+        public:
+            eT lr;
+            eT momentum;
+            eT weight_decay;
+
+            BasicSGD(const std::vector<BasicTensor<eT>> &parameters, eT lr, eT momentum = eT(0),
+                     eT weight_decay = eT(0))
+                    : BasicOptimizer<eT>(parameters, momentum != eT(0) ? 1 : 0), lr(lr), momentum(momentum),
+                      weight_decay(weight_decay)
+            {}
+
+            void step() override
+            {
+                if (momentum != eT(0) && this->state.n_cols == 0)
+                {
+                    throw std::runtime_error("SGD was constructed without momentum and has no buffer for it");
+                }
+
+                const eT rate = lr, mu = momentum, wd = weight_decay;
+                eT *velocity = this->state.n_cols ? this->state.colptr(0) : nullptr;
+
+                this->update([&](eT *w, const eT *g, arma::uword offset, arma::uword n)
+                             {
+                                 if (mu == eT(0))
+                                 {
+                                     for (arma::uword k = 0; k < n; ++k) w[k] -= rate * (g[k] + wd * w[k]);
+                                     return;
+                                 }
+
+                                 eT *v = velocity + offset;
+
+                                 for (arma::uword k = 0; k < n; ++k)
+                                 {
+                                     v[k] = mu * v[k] + g[k] + wd * w[k];
+                                     w[k] -= rate * v[k];
+                                 }
+                             });
+            }
+        };
+
+        // Adam with bias-corrected first and second moments. weight_decay is added to the gradient (L2); AdamW
+        // instead decays the weights directly.
+        template<typename eT>
+        class BasicAdam : public BasicOptimizer<eT>
+        {
+        public:
+            eT lr;
+            eT beta1;
+            eT beta2;
+            eT eps;
+            eT weight_decay;
+
+            BasicAdam(const std::vector<BasicTensor<eT>> &parameters, eT lr = eT(1e-3), eT beta1 = eT(0.9),
+                      eT beta2 = eT(0.999), eT eps = eT(1e-8), eT weight_decay = eT(0))
+                    : BasicAdam(parameters, lr, beta1, beta2, eps, weight_decay, false)
+            {}
+
+            void step() override
+            {
+                ++t;
+
+                const eT b1 = beta1, b2 = beta2, epsilon = eps;
+                const eT step_size = lr / (eT(1) - std::pow(b1, eT(t)));
+                const eT inv_c2 = eT(1) / std::sqrt(eT(1) - std::pow(b2, eT(t)));
+                const eT l2 = decoupled ? eT(0) : weight_decay;
+                const eT decay = decoupled ? eT(1) - lr * weight_decay : eT(1);
+                eT *m_all = this->state.colptr(0);
+                eT *v_all = this->state.colptr(1);
+
+                this->update([&](eT *w, const eT *g, arma::uword offset, arma::uword n)
+                             {
+                                 eT *m = m_all + offset;
+                                 eT *v = v_all + offset;
+
+                                 for (arma::uword k = 0; k < n; ++k)
+                                 {
+                                     const eT gk = g[k] + l2 * w[k];
+                                     m[k] = b1 * m[k] + (eT(1) - b1) * gk;
+                                     v[k] = b2 * v[k] + (eT(1) - b2) * gk * gk;
+                                     w[k] = decay * w[k] - step_size * m[k] / (std::sqrt(v[k]) * inv_c2 + epsilon);
+                                 }
+                             });
+            }
+
+        protected:
+            BasicAdam(const std::vector<BasicTensor<eT>> &parameters, eT lr, eT beta1, eT beta2, eT eps,
+                      eT weight_decay, bool decoupled)
+                    : BasicOptimizer<eT>(parameters, 2), lr(lr), beta1(beta1), beta2(beta2), eps(eps),
+                      weight_decay(weight_decay), decoupled(decoupled)
+            {}
+
+        private:
+            unsigned long long t = 0;
+            bool decoupled;
+        };
+
+        // Adam with decoupled weight decay: w is scaled by 1 - lr * weight_decay before the Adam update.
+        template<typename eT>
+        class BasicAdamW : public BasicAdam<eT>
+        {
+        public:
+            BasicAdamW(const std::vector<BasicTensor<eT>> &parameters, eT lr = eT(1e-3), eT beta1 = eT(0.9),
+                       eT beta2 = eT(0.999), eT eps = eT(1e-8), eT weight_decay = eT(1e-2))
+                    : BasicAdam<eT>(parameters, lr, beta1, beta2, eps, weight_decay, true)
+            {}
+        };
+
+        using SGD = BasicSGD<double>;
+
+        using FloatSGD = BasicSGD<float>;
+
+        using Adam = BasicAdam<double>;
+
+        using FloatAdam = BasicAdam<float>;
+
+        using AdamW = BasicAdamW<double>;
+
+        using FloatAdamW = BasicAdamW<float>;
+    }
+}
+
+#endif // OPTIM_HPP
\ No newline at end of file
@@ -0,0 +1,154 @@
+#ifndef PARAMETERS_HPP
+#define PARAMETERS_HPP
+
+#include "base.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <armadillo>
+
+namespace Malphax
+{
+    namespace nn
+    {
+        // Lays the data of its parameters end to end in one buffer and their gradients likewise in another. Each
+        // parameter stays an ordinary leaf Tensor whose data and grad are fixed-size windows onto those buffers, so
+        // operators, backward and optimizers use it as before, while zero_grad(), the gradient norm and clipping
+        // are single passes over one buffer. An optimizer given parameters() in order steps them as one span.
+        //
+        // The gradients are always allocated: zero_grad() zeroes them rather than releasing them. A parameter
+        // still counts as having a gradient only once backward has accumulated into it since the last zero_grad(),
+        // so optimizers leave parameters that took no part in a step alone.
+        template<typename eT>
+        class BasicParameterGroup
+        {
+        public:
+            // Moves the values of tensors, which must be leaves that are not views, have no views and are not already
+            // in a group, into the flat buffers. The tensors themselves are kept, so handles held elsewhere see the
+            // new storage; a view would still point at the old one, so views are taken after the group is made.
+            explicit BasicParameterGroup(const std::vector<BasicTensor<eT>> &tensors)
+                    : storage(std::make_shared<Storage>()), params(tensors)
+            {
+                arma::uword total = 0;
+
+                for (const auto &tensor: params)
+                {
+                    const BasicTensorImpl<eT> &impl = *tensor.get_impl();
+
+                    if (impl.grad_fn || impl.base || impl.flat_storage)
+                    {
+                        throw std::runtime_error("A parameter group takes only leaf tensors that are not views and "
+                                                 "not already in a group");
+                    }
+
+                    if (impl.n_views > 0)
+                    {
+                        throw std::runtime_error("A parameter group cannot take a tensor that has views; create the "
+                                                 "group before taking views of its parameters");
+                    }
+
+                    for (const auto &other: params)
+                    {
+                        if (&other == &tensor) break;
+                        if (other.get_impl() == tensor.get_impl())
+                        {
+                            throw std::runtime_error("A tensor was given to a parameter group twice");
+                        }
+                    }
+
+                    total += impl.data.n_elem;
+                }
+
+                storage->data.set_size(total);
+                storage->grad.set_size(total);
+
+                arma::uword offset = 0;
+
+                for (const auto &tensor: params)
+                {
+                    BasicTensorImpl<eT> &impl = *tensor.get_impl();
+                    const arma::uword n = impl.data.n_elem;
+
+                    impl.bind_flat(storage->data.memptr() + offset, storage->grad.memptr() + offset, storage);
+                    offset += n;
+                }
+            }
+
+            BasicParameterGroup(std::initializer_list<BasicTensor<eT>> tensors)
+                    : BasicParameterGroup(std::vector<BasicTensor<eT>>(tensors))
+            {}
+
+            const std::vector<BasicTensor<eT>> &parameters() const
+            {
+                return params;
+            }
+
+            // Every parameter's values and gradients, in the order of parameters().
+            arma::Col<eT> &data()
+            { return storage->data; }
+
+            const arma::Col<eT> &data() const
+            { return storage->data; }
+
+            arma::Col<eT> &grad()
+            { return storage->grad; }
+
+            const arma::Col<eT> &grad() const
+            { return storage->grad; }
+
+            arma::uword n_elem() const
+            {
+                return storage->data.n_elem;
+            }
+
+            void zero_grad()
+            {
+                storage->grad.zeros();
+
+                for (const auto &tensor: params)
+                {
+                    tensor.get_impl()->flat_grad_written = false;
+                }
+            }
+
+            eT grad_norm() const
+            {
+                return storage->grad.is_empty() ? eT(0) : eT(arma::norm(storage->grad, 2));
+            }
+
+            // Scales all gradients together so that their global L2 norm is at most max_norm, and returns the
+            // norm they had before.
+            eT clip_grad_norm(eT max_norm)
+            {
+                const eT norm = grad_norm();
+
+                if (norm > max_norm)
+                {
+                    storage->grad *= max_norm / (norm + eT(1e-6));
+                }
+
+                return norm;
+            }
+
+        private:
+            struct Storage
+            {
+                arma::Col<eT> data;
+                arma::Col<eT> grad;
+            };
+
+            std::shared_ptr<Storage> storage;
+            std::vector<BasicTensor<eT>> params;
+        };
+
+        using ParameterGroup = BasicParameterGroup<double>;
+
+        using FloatParameterGroup = BasicParameterGroup<float>;
+    }
+}
+
+#endif // PARAMETERS_HPP
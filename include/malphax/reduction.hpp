@@ -0,0 +1,231 @@
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include "memory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <armadillo>
+
+namespace Malphax
+{
+    // Kernels shared by the reducing operators. A reduction collapses any of dim 0 (down the rows), dim 1 (across
+    // the columns) and dim 2 (across the slices of a batch); every input element maps to one output element, so
+    // forward and backward are single loops. Shapes are those of the data, the slices lying side by side.
+    namespace reduction
+    {
+        struct Axes
+        {
+            bool dim0 = false;
+            bool dim1 = false;
+            bool dim2 = false;
+            arma::uword n_slices = 1;
+        };
+
+        inline Axes all(arma::uword n_slices = 1)
+        {
+            Axes axes;
+            axes.dim0 = true;
+            axes.dim1 = true;
+            axes.dim2 = true;
+            axes.n_slices = n_slices;
+            return axes;
+        }
+
+        inline Axes axes(std::initializer_list<unsigned long long> dims, arma::uword n_slices = 1)
+        {
+            if (dims.size() == 0)
+            {
+                throw std::runtime_error("At least one dimension to reduce is required");
+            }
+
+            Axes axes;
+            axes.n_slices = n_slices;
+
+            for (unsigned long long dim: dims)
+            {
+                if (dim > 2)
+                {
+                    throw std::runtime_error("Dimension must be 0 (rows), 1 (columns) or 2 (slices)");
+                }
+
+                (dim == 0 ? axes.dim0 : dim == 1 ? axes.dim1 : axes.dim2) = true;
+            }
+
+            return axes;
+        }
+
+        inline arma::uword reduced_rows(arma::uword n_rows, const Axes &axes)
+        {
+            return axes.dim0 ? 1 : n_rows;
+        }
+
+        inline arma::uword reduced_cols(arma::uword n_cols, const Axes &axes)
+        {
+            return (axes.dim1 ? 1 : n_cols / axes.n_slices) * (axes.dim2 ? 1 : axes.n_slices);
+        }
+
+        inline arma::uword reduced_slices(const Axes &axes)
+        {
+            return axes.dim2 ? 1 : axes.n_slices;
+        }
+
+        inline arma::uword count(arma::uword n_rows, arma::uword n_cols, const Axes &axes)
+        {
+            return (axes.dim0 ? n_rows : 1) * (axes.dim1 ? n_cols / axes.n_slices : 1) *
+                   (axes.dim2 ? axes.n_slices : 1);
+        }
+
+        // Calls f(k, r) for every element k of an n_rows x n_cols matrix, r being the output element it reduces into.
+        template<typename F>
+        void for_each(arma::uword n_rows, arma::uword n_cols, const Axes &axes, F f)
+        {
+            const arma::uword slice_cols = n_cols / axes.n_slices;
+            const arma::uword row_step = axes.dim0 ? 0 : 1;
+            const arma::uword col_step = axes.dim1 ? 0 : reduced_rows(n_rows, axes);
+            const arma::uword slice_step = axes.dim2 ? 0 : reduced_rows(n_rows, axes) * (axes.dim1 ? 1 : slice_cols);
+            arma::uword k = 0;
+
+            for (arma::uword s = 0; s < axes.n_slices; ++s)
+            {
+                for (arma::uword j = 0; j < slice_cols; ++j)
+                {
+                    for (arma::uword i = 0; i < n_rows; ++i)
+                    {
+                        f(k++, i * row_step + j * col_step + s * slice_step);
+                    }
+                }
+            }
+        }
+
+        // The reductions write into out, which must already be reduced_rows x reduced_cols of X, so that an operator
+        // can hand them its result buffer. The overloads returning a matrix allocate one.
+        template<typename eT>
+        void sum(arma::Mat<eT> &out, const arma::Mat<eT> &X, const Axes &axes)
+        {
+            const bool single = axes.n_slices == 1;
+
+            if (axes.dim0 && axes.dim1 && (axes.dim2 || single))
+            {
+                out(0, 0) = arma::accu(X);
+                return;
+            }
+
+            // Down the rows the slices make no difference; across the columns only a single one can use arma::sum.
+            if (axes.dim0 && !axes.dim1 && (!axes.dim2 || single))
+            {
+                out = arma::sum(X, 0);
+                return;
+            }
+
+            if (single && axes.dim1)
+            {
+                out = arma::sum(X, 1);
+                return;
+            }
+
+            out.zeros();
+            const eT *x = X.memptr();
+            eT *o = out.memptr();
+
+            for_each(X.n_rows, X.n_cols, axes, [&](arma::uword k, arma::uword r) { o[r] += x[k]; });
+        }
+
+        template<typename eT>
+        arma::Mat<eT> sum(const arma::Mat<eT> &X, const Axes &axes)
+        {
+            arma::Mat<eT> out(reduced_rows(X.n_rows, axes), reduced_cols(X.n_cols, axes), arma::fill::none);
+            sum(out, X, axes);
+            return out;
+        }
+
+        template<typename eT>
+        void mean(arma::Mat<eT> &out, const arma::Mat<eT> &X, const Axes &axes)
+        {
+            sum(out, X, axes);
+            out /= static_cast<eT>(count(X.n_rows, X.n_cols, axes));
+        }
+
+        // Max or min under better(); index records, per output element, the first input element attaining it.
+        template<typename eT, typename Better>
+        void extremum(arma::Mat<eT> &out, const arma::Mat<eT> &X, const Axes &axes, arma::uvec &index, Better better)
+        {
+            if (X.is_empty())
+            {
+                throw std::runtime_error("Cannot reduce an empty tensor");
+            }
+
+            index.set_size(out.n_elem);
+            index.fill(X.n_elem);
+
+            const eT *x = X.memptr();
+            eT *o = out.memptr();
+            arma::uword *idx = index.memptr();
+
+            for_each(X.n_rows, X.n_cols, axes, [&](arma::uword k, arma::uword r)
+            {
+                if (idx[r] == X.n_elem || better(x[k], o[r]))
+                {
+                    o[r] = x[k];
+                    idx[r] = k;
+                }
+            });
+        }
+
+        // Max-subtracted, with the per-output sums kept in a block from the current memory::Allocator. A NaN
+        // maximum sticks, as it does for extremum().
+        template<typename eT>
+        void logsumexp(arma::Mat<eT> &out, const arma::Mat<eT> &X, const Axes &axes)
+        {
+            if (X.is_empty())
+            {
+                throw std::runtime_error("Cannot reduce an empty tensor");
+            }
+
+            memory::Block scratch(out.n_elem * sizeof(eT));
+            const eT *x = X.memptr();
+            eT *m = out.memptr();
+            eT *s = scratch.get<eT>();
+
+            out.fill(-std::numeric_limits<eT>::infinity());
+            std::fill(s, s + out.n_elem, eT(0));
+
+            for_each(X.n_rows, X.n_cols, axes, [&](arma::uword k, arma::uword r)
+            {
+                if (x[k] > m[r] || x[k] != x[k]) m[r] = x[k];
+            });
+
+            for_each(X.n_rows, X.n_cols, axes, [&](arma::uword k, arma::uword r) { s[r] += std::exp(x[k] - m[r]); });
+
+            for (arma::uword r = 0; r < out.n_elem; ++r)
+            {
+                if (std::isfinite(m[r])) m[r] += std::log(s[r]);
+            }
+        }
+
+        template<typename eT>
+        arma::Mat<eT> logsumexp(const arma::Mat<eT> &X, const Axes &axes)
+        {
+            arma::Mat<eT> out(reduced_rows(X.n_rows, axes), reduced_cols(X.n_cols, axes), arma::fill::none);
+            logsumexp(out, X, axes);
+            return out;
+        }
+
+        // dst (+)= scale * G read back at every element of the reduced input; dst is overwritten when overwrite.
+        template<typename eT>
+        void spread(arma::Mat<eT> &dst, bool overwrite, const arma::Mat<eT> &G, const Axes &axes, eT scale)
+        {
+            eT *d = dst.memptr();
+            const eT *g = G.memptr();
+
+            if (overwrite)
+                for_each(dst.n_rows, dst.n_cols, axes, [&](arma::uword k, arma::uword r) { d[k] = scale * g[r]; });
+            else
+                for_each(dst.n_rows, dst.n_cols, axes, [&](arma::uword k, arma::uword r) { d[k] += scale * g[r]; });
+        }
+    }
+}
+
+#endif // REDUCTION_HPP
\ No newline at end of file
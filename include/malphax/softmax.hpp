@@ -0,0 +1,318 @@
+#ifndef SOFTMAX_HPP
+#define SOFTMAX_HPP
+
+#include "base.hpp"
+#include "tensor.hpp"
+#include "grad_mode.hpp"
+#include "reduction.hpp"
+#include "tape.hpp"
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <armadillo>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        // dx = y * (g - sum(g * y)) over each reduced group, y being the saved output.
+        template<typename eT>
+        class Softmax_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            reduction::Axes axes;
+
+            Softmax_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl,
+                     reduction::Axes axes)
+                    : A_impl(A_impl), C_impl(C_impl), axes(axes)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const arma::Mat<eT> &Y = C_impl->data;
+                    const eT *y = Y.memptr();
+                    const eT *g = C_impl->grad.memptr();
+
+                    arma::Mat<eT> dot(reduction::reduced_rows(Y.n_rows, axes), reduction::reduced_cols(Y.n_cols, axes),
+                                      arma::fill::zeros);
+                    eT *s = dot.memptr();
+
+                    reduction::for_each(Y.n_rows, Y.n_cols, axes, [&](arma::uword k, arma::uword r)
+                    { s[r] += g[k] * y[k]; });
+
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            eT *d = grad.memptr();
+
+                                            reduction::for_each(Y.n_rows, Y.n_cols, axes,
+                                                                [&](arma::uword k, arma::uword r)
+                                                                {
+                                                                    const eT v = y[k] * (g[k] - s[r]);
+                                                                    d[k] = overwrite ? v : d[k] + v;
+                                                                });
+                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // dx = g - exp(y) * sum(g) over each reduced group; the softmax is recomputed from the saved output.
+        template<typename eT>
+        class LogSoftmax_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            reduction::Axes axes;
+
+            LogSoftmax_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl,
+                        reduction::Axes axes)
+                    : A_impl(A_impl), C_impl(C_impl), axes(axes)
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const arma::Mat<eT> &Y = C_impl->data;
+                    const eT *y = Y.memptr();
+                    const eT *g = C_impl->grad.memptr();
+
+                    arma::Mat<eT> total = reduction::sum(C_impl->grad, axes);
+                    const eT *s = total.memptr();
+
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            eT *d = grad.memptr();
+
+                                            reduction::for_each(Y.n_rows, Y.n_cols, axes,
+                                                                [&](arma::uword k, arma::uword r)
+                                                                {
+                                                                    const eT v = g[k] - std::exp(y[k]) * s[r];
+                                                                    d[k] = overwrite ? v : d[k] + v;
+                                                                });
+                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesOutput;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                Function::release_saved();
+            }
+        };
+
+        // Mean over the rows of logsumexp(x_i) - x_i[label_i]. Only the per-row logsumexp is kept; backward is
+        // (softmax - onehot) / n, with the softmax recomputed from it and the logits.
+        template<typename eT>
+        class CrossEntropy_ : public Function
+        {
+        public:
+            std::shared_ptr<BasicTensorImpl<eT>> A_impl;
+            BasicTensorImpl<eT> *C_impl;
+            arma::uvec labels;
+            arma::Mat<eT> lse;
+
+            CrossEntropy_(const std::shared_ptr<BasicTensorImpl<eT>> &A_impl, BasicTensorImpl<eT> *C_impl,
+                          const arma::uvec &labels, arma::Mat<eT> &&lse)
+                    : A_impl(A_impl), C_impl(C_impl), labels(labels), lse(std::move(lse))
+            {
+                set_inputs(A_impl);
+            }
+
+            void backward() override
+            {
+                if (A_impl->needs_grad(C_impl))
+                {
+                    const arma::Mat<eT> &X = A_impl->data;
+                    const eT scale = C_impl->grad[0] / static_cast<eT>(X.n_rows);
+                    const eT *m = lse.memptr();
+
+                    A_impl->update_grad([&](arma::Mat<eT> &grad, bool overwrite)
+                                        {
+                                            for (arma::uword j = 0; j < X.n_cols; ++j)
+                                            {
+                                                const eT *x = X.colptr(j);
+                                                eT *d = grad.colptr(j);
+
+                                                for (arma::uword i = 0; i < X.n_rows; ++i)
+                                                {
+                                                    const eT v = scale * std::exp(x[i] - m[i]);
+                                                    d[i] = overwrite ? v : d[i] + v;
+                                                }
+                                            }
+
+                                            for (arma::uword i = 0; i < X.n_rows; ++i)
+                                            {
+                                                grad.at(i, labels[i]) -= scale;
+                                            }
+                                        });
+                }
+            }
+
+            unsigned saved_values() const override
+            {
+                return SavesInputs | SavesDerivative;
+            }
+
+            void release_saved() override
+            {
+                A_impl.reset();
+                labels.reset();
+                lse.reset();
+                Function::release_saved();
+            }
+        };
+    }
+
+    // exp(A) normalized to sum to 1 along dim (1 by default: across each row). The maximum is subtracted first, so
+    // large logits do not overflow.
+    template<typename eT>
+    BasicTensor<eT> softmax(const BasicTensor<eT> &A, unsigned long long dim = 1)
+    {
+        const reduction::Axes axes = reduction::axes({dim}, A.n_slices());
+        const arma::Mat<eT> lse = reduction::logsumexp(A.data(), axes);
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = A.n_rows();
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols);
+
+        const eT *x = A.data().memptr();
+        const eT *m = lse.memptr();
+        eT *y = result_impl->data.memptr();
+
+        reduction::for_each(A.data().n_rows, A.data().n_cols, axes, [&](arma::uword k, arma::uword r)
+        { y[k] = std::exp(x[k] - m[r]); });
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::Softmax_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    axes
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // A - logsumexp(A) along dim, without forming exp(A) - log(sum(exp(A))) and the overflow that comes with it.
+    template<typename eT>
+    BasicTensor<eT> log_softmax(const BasicTensor<eT> &A, unsigned long long dim = 1)
+    {
+        const reduction::Axes axes = reduction::axes({dim}, A.n_slices());
+        const arma::Mat<eT> lse = reduction::logsumexp(A.data(), axes);
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = A.n_rows();
+        result_impl->n_cols = A.n_cols();
+        result_impl->n_slices = A.n_slices();
+        result_impl->allocate_data(A.data().n_rows, A.data().n_cols);
+
+        const eT *x = A.data().memptr();
+        const eT *m = lse.memptr();
+        eT *y = result_impl->data.memptr();
+
+        reduction::for_each(A.data().n_rows, A.data().n_cols, axes, [&](arma::uword k, arma::uword r)
+        { y[k] = x[k] - m[r]; });
+
+        if (GradMode::is_enabled() && A.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::LogSoftmax_<eT>>(
+                    A.get_impl(),
+                    result_impl.get(),
+                    axes
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+
+    // Mean negative log-likelihood of labels (one class index per row) under softmax(logits) across each row, as a
+    // 1 x 1 tensor.
+    template<typename eT>
+    BasicTensor<eT> cross_entropy(const BasicTensor<eT> &logits, const arma::uvec &labels)
+    {
+        if (logits.n_slices() != 1)
+        {
+            throw std::runtime_error("cross_entropy() takes a matrix of logits; reshape batches into rows first");
+        }
+
+        const arma::Mat<eT> &X = logits.data();
+
+        if (labels.n_elem != X.n_rows)
+        {
+            throw std::runtime_error("cross_entropy() requires one label per row of logits");
+        }
+
+        if (X.n_rows == 0)
+        {
+            throw std::runtime_error("cross_entropy() requires at least one row of logits");
+        }
+
+        if (labels.max() >= X.n_cols)
+        {
+            throw std::runtime_error("Label out of range of the logits' columns");
+        }
+
+        arma::Mat<eT> lse = reduction::logsumexp(X, reduction::axes({1}));
+        eT total = eT(0);
+
+        for (arma::uword i = 0; i < X.n_rows; ++i)
+        {
+            total += lse[i] - X.at(i, labels[i]);
+        }
+
+        auto result_impl = autograd::make_result<eT>();
+        result_impl->n_rows = 1;
+        result_impl->n_cols = 1;
+        result_impl->allocate_data(1, 1);
+        result_impl->data[0] = total / static_cast<eT>(X.n_rows);
+
+        if (GradMode::is_enabled() && logits.requires_grad())
+        {
+            result_impl->requires_grad = true;
+
+            result_impl->grad_fn = autograd::make_node<autograd::CrossEntropy_<eT>>(
+                    logits.get_impl(),
+                    result_impl.get(),
+                    labels,
+                    std::move(lse)
+            );
+        }
+
+        return BasicTensor<eT>(result_impl);
+    }
+}
+
+#endif // SOFTMAX_HPP
\ No newline at end of file
@@ -0,0 +1,308 @@
+#ifndef TAPE_HPP
+#define TAPE_HPP
+
+#include "base.hpp"
+#include "tensor_impl.hpp"
+#include "tensor.hpp"
+#include "engine.hpp"
+#include "grad_mode.hpp"
+#include "capture.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Malphax
+{
+    namespace autograd
+    {
+        // Bump allocator for the tensors and Functions recorded on a tape. Nothing is freed one by one; each block
+        // counts the objects still alive in it, and a block whose objects are all gone is written over from its
+        // start the next time allocation reaches it. A tensor kept across iterations therefore pins only its own
+        // block, and a training loop settles on the same few blocks, which come from memory::get_allocator().
+        // Allocation is single-threaded, release may happen anywhere.
+        class Arena
+        {
+        public:
+            explicit Arena(std::size_t block_size) : block_size(block_size)
+            {}
+
+            void *allocate(std::size_t size, std::size_t align)
+            {
+                align = std::max(align, alignof(Block *));
+
+                if (block < blocks.size() && blocks[block]->live.load(std::memory_order_acquire) == 0)
+                {
+                    offset = 0;
+                }
+
+                while (true)
+                {
+                    if (block == blocks.size())
+                    {
+                        blocks.push_back(std::make_unique<Block>(std::max(block_size, size + align + sizeof(Block *))));
+                    }
+
+                    Block &current = *blocks[block];
+                    const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(current.memory.get<unsigned char>());
+                    const std::uintptr_t start = (base + offset + sizeof(Block *) + align - 1) / align * align;
+
+                    if (start + size <= base + current.memory.size())
+                    {
+                        // Each object is preceded by its block, which deallocate() reads back.
+                        *reinterpret_cast<Block **>(start - sizeof(Block *)) = &current;
+                        offset = start + size - base;
+                        current.live.fetch_add(1, std::memory_order_relaxed);
+                        return reinterpret_cast<void *>(start);
+                    }
+
+                    // A block that cannot hold the object even empty is passed over for a new one.
+                    block = offset == 0 ? blocks.size() : next_free(block + 1);
+                    offset = 0;
+                }
+            }
+
+            void deallocate(void *ptr)
+            {
+                Block *owner = *reinterpret_cast<Block **>(static_cast<unsigned char *>(ptr) - sizeof(Block *));
+                owner->live.fetch_sub(1, std::memory_order_release);
+            }
+
+        private:
+            struct Block
+            {
+                memory::Block memory;
+                std::atomic<std::size_t> live{0};
+
+                explicit Block(std::size_t size) : memory(size)
+                {}
+            };
+
+            // The first block from `from` on, wrapping around, with nothing alive in it, or blocks.size() for a new
+            // one.
+            std::size_t next_free(std::size_t from) const
+            {
+                for (std::size_t k = 0; k < blocks.size(); ++k)
+                {
+                    const std::size_t i = (from + k) % blocks.size();
+                    if (i != block && blocks[i]->live.load(std::memory_order_acquire) == 0) return i;
+                }
+
+                return blocks.size();
+            }
+
+            std::vector<std::unique_ptr<Block>> blocks;
+            std::size_t block_size;
+            std::size_t block = 0;
+            std::size_t offset = 0;
+        };
+
+        // Each object keeps its arena alive, so tensors may outlive the tape that recorded them.
+        template<typename T>
+        class ArenaAllocator
+        {
+        public:
+            typedef T value_type;
+
+            std::shared_ptr<Arena> arena;
+
+            explicit ArenaAllocator(std::shared_ptr<Arena> arena) : arena(std::move(arena))
+            {}
+
+            template<typename U>
+            ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena)
+            {}
+
+            T *allocate(std::size_t n)
+            {
+                return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+            }
+
+            void deallocate(T *ptr, std::size_t)
+            {
+                arena->deallocate(ptr);
+            }
+
+            template<typename U>
+            bool operator==(const ArenaAllocator<U> &other) const
+            {
+                return arena == other.arena;
+            }
+
+            template<typename U>
+            bool operator!=(const ArenaAllocator<U> &other) const
+            {
+                return arena != other.arena;
+            }
+        };
+
+        // Wengert list: while a TapeGuard is active, every result an operator produces is allocated, together with
+        // its Function, from the tape's arena and appended to records. Creation order is normally a topological
+        // order, so backward replays the records in reverse instead of searching the graph. Records do not own
+        // their results: a result nothing else holds is freed as usual and skipped by backward.
+        class Tape
+        {
+        public:
+            std::shared_ptr<Arena> arena;
+            std::vector<std::weak_ptr<TensorImplBase>> records;
+
+            explicit Tape(std::size_t block_size = 64 * 1024) : arena(std::make_shared<Arena>(block_size))
+            {}
+
+            Tape(const Tape &) = delete;
+
+            Tape &operator=(const Tape &) = delete;
+
+            template<typename eT>
+            void backward(const BasicTensor<eT> &root, bool retain_graph = false)
+            {
+                std::shared_ptr<BasicTensorImpl<eT>> impl = root.get_impl();
+
+                if (!impl->requires_grad)
+                {
+                    return;
+                }
+
+                if (impl->grad.is_empty())
+                {
+                    impl->allocate_grad().ones();
+                }
+
+                // Recomputation during the replay (checkpoints) must not append to the records being walked.
+                struct Pause
+                {
+                    Tape *previous;
+
+                    ~Pause()
+                    {
+                        current() = previous;
+                    }
+                } pause{current()};
+
+                current() = nullptr;
+
+                // The results still alive, each held only until backward has run its node.
+                std::vector<std::shared_ptr<TensorImplBase>> live;
+                live.reserve(records.size());
+
+                for (const auto &record: records)
+                {
+                    if (std::shared_ptr<TensorImplBase> result = record.lock()) live.push_back(std::move(result));
+                }
+
+                Engine::execute_tape(live, impl.get(), retain_graph, true);
+
+                if (!retain_graph)
+                {
+                    clear();
+                }
+            }
+
+            void clear()
+            {
+                records.clear();
+            }
+
+            // A weak record keeps its result's arena slot allocated, so expired ones are dropped before the records
+            // grow.
+            void record(const std::shared_ptr<TensorImplBase> &result)
+            {
+                if (records.size() == records.capacity())
+                {
+                    records.erase(std::remove_if(records.begin(), records.end(),
+                                                 [](const std::weak_ptr<TensorImplBase> &r) { return r.expired(); }),
+                                  records.end());
+                }
+
+                records.push_back(result);
+            }
+
+            std::size_t size() const
+            {
+                return records.size();
+            }
+
+            static Tape *&current()
+            {
+                static thread_local Tape *tape = nullptr;
+                return tape;
+            }
+        };
+
+        class TapeGuard
+        {
+        public:
+            explicit TapeGuard(Tape &tape) : prev_tape(Tape::current())
+            {
+                Tape::current() = &tape;
+            }
+
+            TapeGuard(const TapeGuard &) = delete;
+
+            TapeGuard &operator=(const TapeGuard &) = delete;
+
+            ~TapeGuard()
+            {
+                Tape::current() = prev_tape;
+            }
+
+        private:
+            Tape *prev_tape;
+        };
+
+        // Result of an operator: taken from the active capture, else recorded on the active tape when there is one
+        // and grad recording is on.
+        template<typename eT, typename... Args>
+        std::shared_ptr<BasicTensorImpl<eT>> make_result(Args &&... args)
+        {
+            if (Capture *capture = Capture::current())
+            {
+                return capture->result<eT>(std::forward<Args>(args)...);
+            }
+
+            Tape *tape = Tape::current();
+
+            if (!tape || !GradMode::is_enabled())
+            {
+                return std::allocate_shared<BasicTensorImpl<eT>>(memory::StdAllocator<BasicTensorImpl<eT>>(),
+                                                                  std::forward<Args>(args)...);
+            }
+
+            auto impl = std::allocate_shared<BasicTensorImpl<eT>>(ArenaAllocator<BasicTensorImpl<eT>>(tape->arena),
+                                                                  std::forward<Args>(args)...);
+            tape->record(impl);
+            return impl;
+        }
+
+        template<typename T, typename... Args>
+        std::shared_ptr<T> allocate_node(Args &&... args)
+        {
+            if (Capture *capture = Capture::current())
+            {
+                return capture->node<T>(std::forward<Args>(args)...);
+            }
+
+            Tape *tape = Tape::current();
+
+            if (!tape)
+            {
+                return std::allocate_shared<T>(memory::StdAllocator<T>(), std::forward<Args>(args)...);
+            }
+
+            return std::allocate_shared<T>(ArenaAllocator<T>(tape->arena), std::forward<Args>(args)...);
+        }
+
+        // Node of an operator, holding on to the data of the inputs it saves.
+        template<typename T, typename... Args>
+        std::shared_ptr<T> make_node(Args &&... args)
+        {
+            std::shared_ptr<T> node = allocate_node<T>(std::forward<Args>(args)...);
+            node->hold_saved_inputs();
+            return node;
+        }
+    }
+}
+
+#endif // TAPE_HPP
\ No newline at end of file
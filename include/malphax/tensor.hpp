@@ -3,58 +3,118 @@
 
 #include "base.hpp"
 #include "tensor_impl.hpp"
+#include "engine.hpp"
+#include "capture.hpp"
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
-#include <queue>
 #include <armadillo>
 #include <iostream>
-#include <unordered_set>
 
 namespace Malphax
 {
-    class Tensor
+    template<typename eT>
+    class BasicTensor
     {
     private:
 
-        std::shared_ptr<TensorImpl> impl;
+        std::shared_ptr<BasicTensorImpl<eT>> impl;
+
+        // Counts this handle on impl; see TensorImplBase::n_handles.
+        void hold()
+        {
+            if (impl) impl->add_handle();
+        }
+
+        void drop()
+        {
+            if (impl) impl->drop_handle();
+        }
 
     public:
 
-        Tensor() : impl(std::make_shared<TensorImpl>())
-        {}
+        typedef eT elem_type;
 
+        BasicTensor() : impl(std::make_shared<BasicTensorImpl<eT>>())
+        { hold(); }
 
-        Tensor(unsigned long n_rows, unsigned long n_cols, const std::string &init = "norm", bool requires_grad = true)
-                : impl(std::make_shared<TensorImpl>(n_rows, n_cols, init, requires_grad))
-        {}
 
-        explicit Tensor(const arma::mat &data, bool requires_grad = true)
-                : impl(std::make_shared<TensorImpl>(data, requires_grad))
-        {}
+        BasicTensor(unsigned long n_rows, unsigned long n_cols, const std::string &init = "norm", bool requires_grad = true)
+                : impl(std::make_shared<BasicTensorImpl<eT>>(n_rows, n_cols, init, requires_grad))
+        { hold(); }
+
+        explicit BasicTensor(const arma::Mat<eT> &data, bool requires_grad = true)
+                : impl(std::make_shared<BasicTensorImpl<eT>>(data, requires_grad))
+        { hold(); }
+
+        explicit BasicTensor(const arma::Cube<eT> &data, bool requires_grad = true)
+                : impl(std::make_shared<BasicTensorImpl<eT>>(data, requires_grad))
+        { hold(); }
 
-        explicit Tensor(std::shared_ptr<TensorImpl> impl) : impl(impl)
+        BasicTensor(unsigned long n_rows, unsigned long n_cols, unsigned long n_slices,
+                    const std::string &init = "norm", bool requires_grad = true)
+                : impl(std::make_shared<BasicTensorImpl<eT>>(n_rows, n_cols * n_slices, init, requires_grad))
+        {
+            impl->n_cols = n_cols;
+            impl->n_slices = n_slices;
+            hold();
+        }
+
+        explicit BasicTensor(std::shared_ptr<BasicTensorImpl<eT>> impl) : impl(std::move(impl))
+        { hold(); }
+
+        BasicTensor(const BasicTensor &other) : impl(other.impl)
+        { hold(); }
+
+        BasicTensor(BasicTensor &&other) noexcept: impl(std::move(other.impl))
         {}
 
-        Tensor(const Tensor &other) = default;
+        BasicTensor &operator=(const BasicTensor &other)
+        {
+            if (impl != other.impl)
+            {
+                drop();
+                impl = other.impl;
+                hold();
+            }
 
-        Tensor(Tensor &&other) noexcept = default;
+            return *this;
+        }
 
-        Tensor &operator=(const Tensor &other) = default;
+        BasicTensor &operator=(BasicTensor &&other) noexcept
+        {
+            if (this != &other)
+            {
+                drop();
+                impl = std::move(other.impl);
+            }
 
-        Tensor &operator=(Tensor &&other) noexcept = default;
+            return *this;
+        }
+
+        ~BasicTensor()
+        {
+            drop();
+        }
 
-        const arma::mat &data() const
+        const arma::Mat<eT> &data() const
         { return impl->data; }
 
-        arma::mat &data()
+        arma::Mat<eT> &data()
         { return impl->data; }
 
-        const arma::mat &grad() const
+        // Empty until a gradient has been accumulated; reading it allocates nothing.
+        const arma::Mat<eT> &grad() const
         { return impl->grad; }
 
-        arma::mat &grad()
-        { return impl->grad; }
+        // Writable, so a tensor that never received a gradient is given zeros of its own shape first.
+        arma::Mat<eT> &grad()
+        {
+            std::lock_guard<std::mutex> lock(impl->grad_mutex);
+            if (impl->grad.is_empty()) impl->allocate_grad().zeros();
+            return impl->grad;
+        }
 
         unsigned long long n_rows() const
         { return impl->n_rows; }
@@ -62,6 +122,13 @@ namespace Malphax
         unsigned long long n_cols() const
         { return impl->n_cols; }
 
+        unsigned long long n_slices() const
+        { return impl->n_slices; }
+
+        // A copy of the data as a cube; data() holds the same slices side by side.
+        arma::Cube<eT> cube() const
+        { return arma::Cube<eT>(impl->data.memptr(), impl->n_rows, impl->n_cols, impl->n_slices); }
+
         bool requires_grad() const
         { return impl->requires_grad; }
 
@@ -74,71 +141,30 @@ namespace Malphax
         void set_grad_fn(std::shared_ptr<autograd::Function> fn)
         { impl->grad_fn = fn; }
 
-        std::shared_ptr<TensorImpl> get_impl() const
+        std::shared_ptr<BasicTensorImpl<eT>> get_impl() const
         { return impl; }
 
-        void zero_grad()
+        void zero_grad(bool release = true)
         {
-            impl->zero_grad();
+            impl->zero_grad(release);
         }
 
-        void backward()
+        void backward(bool retain_graph = false)
         {
             if (!impl->requires_grad)
             {
                 return;
             }
 
-            if (impl->grad.n_elem == 0 || (impl->grad.n_rows == 0 || impl->grad.n_cols == 0))
-            {
-
-                impl->grad = arma::zeros(impl->data.n_rows, impl->data.n_cols);
-            }
-
-            if (arma::accu(impl->grad) == 0)
+            if (impl->grad.is_empty())
             {
-                impl->grad.ones(impl->data.n_rows, impl->data.n_cols);
+                impl->allocate_grad().ones();
             }
 
-            std::unordered_set<std::shared_ptr<TensorImpl>> impl_refs;
-
-            std::queue<std::shared_ptr<TensorImpl>> queue;
-            queue.push(impl);
-
-            std::unordered_set<TensorImpl *> visited;
-
-            while (!queue.empty())
-            {
-                auto tensor_impl = queue.front();
-                queue.pop();
-
-                if (visited.find(tensor_impl.get()) != visited.end())
-                {
-                    continue;
-                }
-                visited.insert(tensor_impl.get());
-
-                if (tensor_impl->grad_fn)
-                {
-                    tensor_impl->grad_fn->backward();
-
-                    for (auto parent: tensor_impl->grad_fn->parents())
-                    {
-                        if (parent && parent->requires_grad())
-                        {
-                            impl_refs.insert(parent->get_impl());
-
-                            if (parent->get_impl().get() != tensor_impl.get())
-                                queue.push(parent->get_impl());
-                        }
-                    }
-
-                    for (const auto &saved_impl: tensor_impl->grad_fn->input_tensor_impls)
-                    {
-                        impl_refs.insert(saved_impl);
-                    }
-                }
-            }
+            if (autograd::Capture *capture = autograd::Capture::current())
+                capture->backward(impl, retain_graph);
+            else
+                autograd::Engine::execute(impl, retain_graph);
         }
     };
 }
@@ -2,54 +2,476 @@
 #define TENSOR_IMPL_HPP
 
 #include "base.hpp"
+#include "grad_mode.hpp"
+#include "broadcast.hpp"
+#include "kernels.hpp"
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
 #include <armadillo>
 
 namespace Malphax
 {
-    class TensorImpl : public std::enable_shared_from_this<TensorImpl>
+    // Everything the engine needs to walk and schedule a graph, independent of the element type.
+    class TensorImplBase : public std::enable_shared_from_this<TensorImplBase>
     {
     public:
-        arma::mat data;
-        arma::mat grad;
         unsigned long long n_rows;
         unsigned long long n_cols;
+        // A batch of n_slices matrices of n_rows x n_cols. data holds them side by side, as arma::Cube lays out its
+        // slices, so anything element-wise runs over a batch unchanged.
+        unsigned long long n_slices = 1;
         bool requires_grad;
         std::shared_ptr<autograd::Function> grad_fn;
+        unsigned long long visit_epoch = 0;
+        unsigned long long grad_epoch = 0;
+        std::size_t topo_index = 0;
+        std::mutex grad_mutex;
+        // Bumped by every in-place operator. A view counts on its base's counter, since they share storage.
+        unsigned long long own_version = 0;
+        unsigned long long *version_counter = &own_version;
+        // Version at which an in-place operator last put a new grad_fn on this tensor.
+        unsigned long long history_version = 0;
+        // Tensor handles to this tensor, and Functions whose backward reads its data. Graph edges only need the
+        // gradient, so once both are gone the data is released (see release_data()) even though the tensor lives on.
+        std::atomic<std::size_t> n_handles{0};
+        std::atomic<std::size_t> n_data_readers{0};
 
-        TensorImpl() : requires_grad(false), n_rows(0), n_cols(0)
+        TensorImplBase(unsigned long long n_rows, unsigned long long n_cols, bool requires_grad)
+                : n_rows(n_rows), n_cols(n_cols), requires_grad(requires_grad)
         {}
 
-        TensorImpl(unsigned long n_rows, unsigned long n_cols, const std::string &init = "norm",
-                   bool requires_grad = true)
-                : requires_grad(requires_grad), n_rows(n_rows), n_cols(n_cols)
+        TensorImplBase(const TensorImplBase &) = delete;
+
+        TensorImplBase &operator=(const TensorImplBase &) = delete;
+
+        virtual ~TensorImplBase() = default;
+
+        // True when the backward pass that is running consumer has to produce this tensor's gradient.
+        bool needs_grad(const TensorImplBase *consumer) const
+        {
+            return requires_grad && grad_epoch == consumer->visit_epoch;
+        }
+
+        virtual bool has_grad() const = 0;
+
+        virtual void release_grad() = 0;
+
+        // Frees the data unless something besides handles and readers still needs it.
+        virtual void release_data() = 0;
+
+        void add_handle()
+        {
+            n_handles.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void drop_handle()
+        {
+            if (n_handles.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+                n_data_readers.load(std::memory_order_acquire) == 0)
+            {
+                release_data();
+            }
+        }
+
+        void add_reader()
+        {
+            n_data_readers.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void drop_reader()
+        {
+            if (n_data_readers.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+                n_handles.load(std::memory_order_acquire) == 0)
+            {
+                release_data();
+            }
+        }
+    };
+
+    inline void autograd::Function::hold_saved_inputs()
+    {
+        if (holds_inputs || !(saved_values() & SavesInputs))
+        {
+            return;
+        }
+
+        for (std::size_t i = 0; i < input_tensor_impls.size(); ++i)
+        {
+            if (input_tensor_impls[i] && reads_input(i)) input_tensor_impls[i]->add_reader();
+        }
+
+        holds_inputs = true;
+    }
+
+    inline void autograd::Function::drop_saved_inputs()
+    {
+        if (!holds_inputs)
+        {
+            return;
+        }
+
+        holds_inputs = false;
+
+        for (std::size_t i = 0; i < input_tensor_impls.size(); ++i)
+        {
+            if (input_tensor_impls[i] && reads_input(i)) input_tensor_impls[i]->drop_reader();
+        }
+    }
+
+    inline autograd::Function::~Function()
+    {
+        drop_saved_inputs();
+    }
+
+    inline void autograd::Function::set_inputs(const std::shared_ptr<TensorImplBase> &A_impl,
+                                               const std::shared_ptr<TensorImplBase> &B_impl)
+    {
+        input_tensor_impls.reserve(input_tensor_impls.size() + 2);
+        input_versions.reserve(input_versions.size() + 2);
+        set_inputs(A_impl);
+        set_inputs(B_impl);
+    }
+
+    inline void autograd::Function::set_inputs(const std::shared_ptr<TensorImplBase> &A_impl)
+    {
+        input_tensor_impls.push_back(A_impl);
+        input_versions.push_back(A_impl ? *A_impl->version_counter : 0);
+    }
+
+    inline void autograd::Function::check_versions(const TensorImplBase &output, std::size_t first_input) const
+    {
+        const unsigned saved = saved_values();
+
+        for (std::size_t i = first_input; i < input_tensor_impls.size(); ++i)
+        {
+            const TensorImplBase *input = input_tensor_impls[i].get();
+
+            if (!input)
+            {
+                continue;
+            }
+
+            if (input->history_version > input_versions[i])
+            {
+                throw std::runtime_error("A tensor was modified by an in-place operation after another operation "
+                                         "used it; that earlier use can no longer be differentiated");
+            }
+
+            if ((saved & SavesInputs) && reads_input(i) && *input->version_counter != input_versions[i])
+            {
+                throw std::runtime_error("A tensor needed for gradient computation has been modified by an in-place "
+                                         "operation");
+            }
+        }
+
+        if ((saved & SavesOutput) && *output.version_counter != output_version)
+        {
+            throw std::runtime_error("A tensor needed for gradient computation has been modified by an in-place "
+                                     "operation");
+        }
+    }
+
+    template<typename eT>
+    class BasicTensorImpl : public TensorImplBase
+    {
+    public:
+        typedef eT elem_type;
+
+        arma::Mat<eT> data;
+        arma::Mat<eT> grad;
+        // Set on views: the tensor owning the storage data points into.
+        std::shared_ptr<BasicTensorImpl> base;
+        // Set on parameters whose data and grad live in the flat buffers of a ParameterGroup, which this keeps
+        // alive. Neither is ever reallocated: a released gradient is zeroed in place, and flat_grad_written tells
+        // whether anything was accumulated into it since.
+        std::shared_ptr<void> flat_storage;
+        bool flat_grad_written = false;
+        // Live views into this tensor's storage, counted on the tensor that owns it.
+        std::atomic<std::size_t> n_views{0};
+        // Buffers from memory::get_allocator() that data and grad wrap when they were made by allocate_data() and
+        // allocate_grad(). A matrix assigned some other way owns its memory as usual.
+        memory::Block data_block;
+        memory::Block grad_block;
+        // Set on results a capture replays: a released gradient keeps grad_block, and the next first contribution
+        // is written into it instead of a new allocation.
+        bool recycle_grad = false;
+
+        BasicTensorImpl() : TensorImplBase(0, 0, false)
+        {}
+
+        BasicTensorImpl(unsigned long n_rows, unsigned long n_cols, const std::string &init = "norm",
+                        bool requires_grad = true)
+                : TensorImplBase(n_rows, n_cols, requires_grad && !GradMode::is_inference())
         {
             if (init == "norm")
-                data = arma::randn(n_rows, n_cols);
+                data.randn(n_rows, n_cols);
             else if (init == "zeros")
-                data = arma::zeros(n_rows, n_cols);
+                data.zeros(n_rows, n_cols);
             else if (init == "ones")
-                data = arma::ones(n_rows, n_cols);
+                data.ones(n_rows, n_cols);
+            else
+                data.randn(n_rows, n_cols);
+        }
+
+        explicit BasicTensorImpl(const arma::Mat<eT> &data_in, bool requires_grad = true)
+                : TensorImplBase(data_in.n_rows, data_in.n_cols, requires_grad && !GradMode::is_inference()),
+                  data(data_in)
+        {}
+
+        explicit BasicTensorImpl(arma::Mat<eT> &&data_in, bool requires_grad = true)
+                : TensorImplBase(data_in.n_rows, data_in.n_cols, requires_grad && !GradMode::is_inference()),
+                  data(std::move(data_in))
+        {}
+
+        explicit BasicTensorImpl(const arma::Cube<eT> &data_in, bool requires_grad = true)
+                : TensorImplBase(data_in.n_rows, data_in.n_cols, requires_grad && !GradMode::is_inference()),
+                  data(data_in.memptr(), data_in.n_rows, data_in.n_cols * data_in.n_slices)
+        {
+            n_slices = std::max<arma::uword>(data_in.n_slices, 1);
+        }
+
+        // View of mem, which stays owned by base; data keeps its size for good.
+        BasicTensorImpl(const std::shared_ptr<BasicTensorImpl> &base, eT *mem, arma::uword n_rows, arma::uword n_cols)
+                : TensorImplBase(n_rows, n_cols, false), data(mem, n_rows, n_cols, false, true)
+        {
+            set_base(base);
+        }
+
+        ~BasicTensorImpl() override
+        {
+            set_base(nullptr);
+        }
+
+        // Makes this a view into new_base's storage, or no view when it is null.
+        void set_base(const std::shared_ptr<BasicTensorImpl> &new_base)
+        {
+            if (base) --base->storage_owner().n_views;
+
+            base = new_base;
+
+            if (base)
+            {
+                ++base->storage_owner().n_views;
+                version_counter = base->version_counter;
+            }
+            else
+            {
+                version_counter = &own_version;
+            }
+        }
+
+        BasicTensorImpl &storage_owner()
+        {
+            BasicTensorImpl *owner = this;
+            while (owner->base) owner = owner->base.get();
+            return *owner;
+        }
+
+        std::shared_ptr<BasicTensorImpl> shared_this()
+        {
+            return std::static_pointer_cast<BasicTensorImpl>(shared_from_this());
+        }
+
+        bool has_grad() const override
+        {
+            return flat_storage ? flat_grad_written : !grad.is_empty();
+        }
+
+        void release_grad() override
+        {
+            if (flat_storage)
+            {
+                grad.zeros();
+                flat_grad_written = false;
+            }
+            else
+            {
+                wrap(grad, nullptr, 0, 0);
+                if (!recycle_grad) grad_block.reset();
+            }
+        }
+
+        // Kept when the tensor's own node reads its output back, when views or a ParameterGroup share the storage,
+        // and for results a capture recomputes into.
+        void release_data() override
+        {
+            if (base || flat_storage || recycle_grad || n_views.load() > 0 ||
+                (grad_fn && (grad_fn->saved_values() & autograd::SavesOutput)))
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(grad_mutex);
+            wrap(data, nullptr, 0, 0);
+            data_block.reset();
+        }
+
+        // Whether M has this tensor's shape, read from the dimensions rather than data, which may be released.
+        bool shaped_like(const arma::Mat<eT> &M) const
+        {
+            return n_rows == M.n_rows && n_cols * n_slices == M.n_cols;
+        }
+
+        // data, sized n_rows x n_cols in data_block, for an operator about to write every element of its result.
+        arma::Mat<eT> &allocate_data(arma::uword rows, arma::uword cols)
+        {
+            return allocate(data, data_block, rows, cols);
+        }
+
+        // grad, sized like the tensor, for callers about to overwrite all of it. Keeps the buffer it has when that
+        // is the right size, as it is for flat parameters and after a recycled release.
+        arma::Mat<eT> &allocate_grad()
+        {
+            flat_grad_written = true;
+            return flat_storage ? grad : allocate(grad, grad_block, n_rows, n_cols * n_slices);
+        }
+
+        // Moves other's data into this tensor, together with the block it lives in, leaving other without data.
+        void take_data(BasicTensorImpl &other)
+        {
+            if (other.data_block && other.data.memptr() == other.data_block.get<eT>())
+            {
+                data_block = std::move(other.data_block);
+                wrap(data, data_block.get<eT>(), other.data.n_rows, other.data.n_cols, false);
+                wrap(other.data, nullptr, 0, 0);
+            }
+            else
+            {
+                data = std::move(other.data);
+            }
+        }
+
+        // Moves the gradient out, leaving none behind. A gradient in a flat or pooled buffer is copied out, since
+        // the returned matrix must own its memory.
+        arma::Mat<eT> take_grad()
+        {
+            const bool owned = !flat_storage && !(grad_block && grad.memptr() == grad_block.get<eT>());
+            arma::Mat<eT> out = owned ? std::move(grad) : arma::Mat<eT>(grad);
+            release_grad();
+            return out;
+        }
+
+        // Points data and grad at data_mem and grad_mem, which owner keeps alive, after copying the data over.
+        void bind_flat(eT *data_mem, eT *grad_mem, std::shared_ptr<void> owner)
+        {
+            const arma::uword rows = data.n_rows, cols = data.n_cols;
+
+            std::copy(data.memptr(), data.memptr() + data.n_elem, data_mem);
+            if (grad.is_empty())
+                std::fill(grad_mem, grad_mem + data.n_elem, eT(0));
             else
-                data = arma::randn(n_rows, n_cols);
+                std::copy(grad.memptr(), grad.memptr() + grad.n_elem, grad_mem);
+
+            wrap(data, data_mem, rows, cols);
+            flat_grad_written = !grad.is_empty();
+            wrap(grad, grad_mem, rows, cols);
 
-            grad = arma::zeros(n_rows, n_cols);
+            flat_storage = std::move(owner);
         }
 
-        explicit TensorImpl(const arma::mat &data_in, bool requires_grad = true)
-                : data(data_in), n_rows(data_in.n_rows), n_cols(data_in.n_cols), requires_grad(requires_grad)
+        // Rebuilds M as a wrapper of mem, or as an empty matrix of its own when mem is null. Armadillo has no way to
+        // re-point an existing matrix. A strict wrapper refuses to be resized or released; a loose one, resized,
+        // moves to memory of its own and leaves mem alone.
+        static void wrap(arma::Mat<eT> &M, eT *mem, arma::uword n_rows, arma::uword n_cols, bool strict = true)
         {
-            grad = arma::zeros(data.n_rows, data.n_cols);
+            M.~Mat();
+
+            if (mem)
+                new(&M) arma::Mat<eT>(mem, n_rows, n_cols, false, strict);
+            else
+                new(&M) arma::Mat<eT>();
         }
 
-        std::shared_ptr<TensorImpl> shared_this()
+        // Points M at a block of rows x cols, reusing block when it has that size already.
+        static arma::Mat<eT> &allocate(arma::Mat<eT> &M, memory::Block &block, arma::uword rows, arma::uword cols)
         {
-            return shared_from_this();
+            const std::size_t bytes = std::size_t(rows) * cols * sizeof(eT);
+
+            if (block.size() != bytes)
+            {
+                wrap(M, nullptr, 0, 0);
+                block = memory::Block(bytes);
+            }
+
+            if (!block)
+                M.set_size(rows, cols);
+            else if (M.memptr() != block.get<eT>() || M.n_rows != rows || M.n_cols != cols)
+                wrap(M, block.get<eT>(), rows, cols, false);
+
+            return M;
+        }
+
+        // grad stays empty until the first contribution, which is written into it instead of added to zeros.
+        template<typename T>
+        void accumulate_grad(const T &contribution)
+        {
+            std::lock_guard<std::mutex> lock(grad_mutex);
+
+            if (grad.is_empty())
+                allocate_grad() = contribution;
+            else
+                grad += contribution;
+
+            flat_grad_written = true;
         }
 
-        void zero_grad()
+        template<typename T>
+        void subtract_grad(const T &contribution)
         {
-            grad.zeros(data.n_rows, data.n_cols);
+            std::lock_guard<std::mutex> lock(grad_mutex);
+
+            if (grad.is_empty())
+                allocate_grad() = -contribution;
+            else
+                grad -= contribution;
+
+            flat_grad_written = true;
+        }
+
+        // For contributions computed element by element: f(grad, overwrite) runs under the lock with grad sized like
+        // the tensor, and must assign instead of add when overwrite is set.
+        template<typename F>
+        void update_grad(F f)
+        {
+            std::lock_guard<std::mutex> lock(grad_mutex);
+
+            const bool overwrite = grad.is_empty();
+            if (overwrite) allocate_grad();
+
+            f(grad, overwrite);
+            flat_grad_written = true;
+        }
+
+        // grad (+)= f(k) for every element k, in a single pass over the buffer.
+        template<typename F>
+        void accumulate_grad_elementwise(F f)
+        {
+            update_grad([&f](arma::Mat<eT> &dst, bool overwrite) { kernels::accumulate(dst, overwrite, f); });
+        }
+
+        // grad (+)= f(i, j) summed over the n_rows x n_cols shape this tensor was broadcast to.
+        template<typename F>
+        void accumulate_grad_broadcast(arma::uword n_rows, arma::uword n_cols, F f)
+        {
+            update_grad([&](arma::Mat<eT> &dst, bool overwrite) { broadcast::reduce(dst, overwrite, n_rows, n_cols, f); });
+        }
+
+        void zero_grad(bool release = true)
+        {
+            if (release && !flat_storage)
+            {
+                wrap(grad, nullptr, 0, 0);
+                grad_block.reset();
+            }
+            else if (!grad.is_empty())
+                grad.zeros();
+
+            flat_grad_written = false;
         }
     };
 }
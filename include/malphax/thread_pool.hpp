@@ -0,0 +1,179 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Malphax
+{
+    // Work-stealing pool: a task submitted from a worker lands on that worker's own deque and is popped LIFO,
+    // idle workers steal FIFO from the others.
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(std::size_t n_threads)
+        {
+            if (n_threads == 0)
+            {
+                n_threads = 1;
+            }
+
+            for (std::size_t i = 0; i < n_threads; ++i)
+            {
+                workers.push_back(std::unique_ptr<Worker>(new Worker()));
+            }
+
+            for (std::size_t i = 0; i < n_threads; ++i)
+            {
+                threads.emplace_back([this, i]() { run(i); });
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+
+            for (auto &thread: threads)
+            {
+                thread.join();
+            }
+        }
+
+        std::size_t size() const
+        {
+            return workers.size();
+        }
+
+        static bool on_worker_thread()
+        {
+            return current_pool() != nullptr;
+        }
+
+        void submit(std::function<void()> task)
+        {
+            std::size_t index;
+
+            if (current_pool() == this)
+            {
+                index = current_index();
+            }
+            else
+            {
+                index = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+            }
+
+            queued.fetch_add(1);
+            {
+                std::lock_guard<std::mutex> lock(workers[index]->mutex);
+                workers[index]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+            }
+            wake.notify_one();
+        }
+
+    private:
+        struct Worker
+        {
+            std::deque<std::function<void()>> tasks;
+            std::mutex mutex;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::atomic<std::size_t> queued{0};
+        std::atomic<std::size_t> next_worker{0};
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+
+        static ThreadPool *&current_pool()
+        {
+            static thread_local ThreadPool *pool = nullptr;
+            return pool;
+        }
+
+        static std::size_t &current_index()
+        {
+            static thread_local std::size_t index = 0;
+            return index;
+        }
+
+        bool pop_local(std::size_t index, std::function<void()> &task)
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+
+            if (workers[index]->tasks.empty())
+            {
+                return false;
+            }
+
+            task = std::move(workers[index]->tasks.back());
+            workers[index]->tasks.pop_back();
+            return true;
+        }
+
+        bool steal(std::size_t index, std::function<void()> &task)
+        {
+            for (std::size_t offset = 1; offset < workers.size(); ++offset)
+            {
+                Worker &victim = *workers[(index + offset) % workers.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+
+                if (!victim.tasks.empty())
+                {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void run(std::size_t index)
+        {
+            current_pool() = this;
+            current_index() = index;
+
+            std::function<void()> task;
+
+            while (true)
+            {
+                if (pop_local(index, task) || steal(index, task))
+                {
+                    queued.fetch_sub(1);
+                    task();
+                    task = nullptr;
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+
+                if (stopping && queued.load() == 0)
+                {
+                    return;
+                }
+            }
+        }
+    };
+}
+
+#endif // THREAD_POOL_HPP
\ No newline at end of file
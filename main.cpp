@@ -12,8 +12,7 @@ int main()
         Malphax::Tensor b(4, 4, "ones");
         Malphax::Tensor c(4, 4, "ones");
         auto d = Malphax::exp(Malphax::matmul(a, b) * c + c / 16);
-        auto e = Malphax::sum(d, 1);
-        auto f = Malphax::sum(e, 0);
+        auto f = Malphax::sum(d);
         f.backward();
         std::cout << "Gradient of a:\n" << a.grad() << std::endl;
         std::cout << "Gradient of b:\n" << b.grad() << std::endl;
@@ -24,7 +23,7 @@ int main()
         Malphax::Tensor a(4, 4, "ones");
         Malphax::Tensor b(4, 4, "ones");
         Malphax::Tensor c(4, 4, "ones");
-        auto d = Malphax::mean(Malphax::mean(a + b * b * b * b, 1), 0);
+        auto d = Malphax::mean(a + b * b * b * b);
         d.backward();
         std::cout << "Gradient of a:\n" << a.grad() << std::endl;
         std::cout << "Gradient of b:\n" << b.grad() << std::endl;
@@ -36,14 +35,155 @@ int main()
         Malphax::Tensor b(4, 4, "ones");
         Malphax::Tensor c(4, 4, "ones");
         auto d = Malphax::log(Malphax::matmul(a * a, b + c + a) * c + c * c);
-        auto e = Malphax::sum(d, 1);
-        auto f = Malphax::sum(e, 0);
+        auto f = Malphax::sum(d);
         f.backward();
         std::cout << "Gradient of a:\n" << a.grad() << std::endl;
         std::cout << "Gradient of b:\n" << b.grad() << std::endl;
         std::cout << "Gradient of c:\n" << c.grad() << std::endl;
     }
 
+    {
+        Malphax::Tensor a(4, 4, "ones");
+        Malphax::Tensor b(4, 4, "ones");
+        Malphax::Tensor c(4, 4, "ones");
+        auto d = Malphax::fuse([](auto x, auto c) { return exp(x * c + c / 16); }, Malphax::matmul(a, b), c);
+        auto f = Malphax::sum(d);
+        f.backward();
+        std::cout << "Gradient of a:\n" << a.grad() << std::endl;
+        std::cout << "Gradient of b:\n" << b.grad() << std::endl;
+        std::cout << "Gradient of c:\n" << c.grad() << std::endl;
+    }
+
+    {
+        // add_ gives y, recorded before z, an input z; the tape must still match a graph search.
+        Malphax::Tensor x(4, 4, "norm");
+        auto y = Malphax::exp(x);
+        auto z = x * 2;
+        Malphax::add_(y, z);
+        Malphax::sum(y).backward();
+        const arma::mat expected = x.grad();
+
+        x.zero_grad();
+        Malphax::autograd::Tape tape;
+        Malphax::Tensor s;
+        {
+            Malphax::autograd::TapeGuard guard(tape);
+            auto y_tape = Malphax::exp(x);
+            auto z_tape = x * 2;
+            Malphax::add_(y_tape, z_tape);
+            s = Malphax::sum(y_tape);
+        }
+        tape.backward(s);
+        std::cout << "Tape vs graph gradient difference: " << arma::abs(x.grad() - expected).max() << std::endl;
+    }
+    {
+        // A replay has to give what a fresh run on the same inputs gives.
+        Malphax::Tensor x(8, 4, "norm");
+        Malphax::Tensor W(4, 3, "norm");
+        Malphax::Tensor loss;
+        auto step = Malphax::capture([&]()
+                                     {
+                                         loss = Malphax::mean(Malphax::tanh(Malphax::matmul(x, W)));
+                                         loss.backward();
+                                     });
+
+        x.data().randn();
+        W.zero_grad();
+        step.replay();
+        const double replayed = loss.data()(0, 0);
+        const arma::mat replayed_grad = W.grad();
+
+        W.zero_grad();
+        auto fresh = Malphax::mean(Malphax::tanh(Malphax::matmul(x, W)));
+        fresh.backward();
+        std::cout << "Replay vs fresh loss difference: " << std::abs(replayed - fresh.data()(0, 0)) << std::endl;
+        std::cout << "Replay vs fresh gradient difference: " << arma::abs(replayed_grad - W.grad()).max()
+                  << std::endl;
+    }
+    {
+        // relu keeps only its bit mask: the pre-activation goes once nothing but the graph refers to it.
+        Malphax::Tensor x(64, 32, "norm");
+        Malphax::Tensor W(32, 16, "norm");
+        auto y = Malphax::relu(Malphax::matmul(x, W));
+        auto node = std::dynamic_pointer_cast<Malphax::autograd::ReLU_<double>>(y.grad_fn());
+        std::cout << "Pre-activation elements kept by relu: " << node->A_impl->data.n_elem << std::endl;
+        Malphax::sum(y).backward();
+        std::cout << "Gradient of W after relu:\n" << W.grad().submat(0, 0, 1, 3) << std::endl;
+    }
+    {
+        // Mini-batches of a sample-major dataset are column views: no batch is copied, and matmul reads each one
+        // transposed through a BLAS flag.
+        Malphax::Tensor X(8, 64, "norm", false);
+        Malphax::Tensor W(8, 3, "norm");
+        const unsigned long long batch_size = 16;
+
+        for (unsigned long long first = 0; first < X.n_cols(); first += batch_size)
+        {
+            auto batch = Malphax::cols(X, first, first + batch_size - 1);
+            auto loss = Malphax::mean(Malphax::tanh(Malphax::matmul(batch, W, true, false)));
+            loss.backward();
+
+            if (first == 0)
+            {
+                std::cout << "Batch shares the dataset's storage: "
+                          << (batch.data().memptr() == X.data().colptr(first)) << std::endl;
+            }
+        }
+
+        std::cout << "Gradient of W over all batches:\n" << W.grad().submat(0, 0, 1, 2) << std::endl;
+    }
+    {
+        // Grouped parameters receive their gradients through the gemms of matmul and linear; a step must move them.
+        Malphax::Tensor x(8, 4, "norm", false);
+        Malphax::Tensor W(4, 3, "norm");
+        Malphax::Tensor b(1, 3, "zeros");
+        Malphax::Tensor V(3, 2, "norm");
+        Malphax::nn::ParameterGroup group({W, b, V});
+        Malphax::optim::SGD sgd(group.parameters(), 0.1);
+        const arma::mat W_before = W.data();
+        const arma::mat b_before = b.data();
+        const arma::mat V_before = V.data();
+
+        auto h = Malphax::linear(x, W, b, Malphax::Activation::Tanh);
+        Malphax::sum(Malphax::matmul(h, V)).backward();
+        sgd.step();
+
+        std::cout << "Grouped W, b and V changed by the step: " << arma::abs(W.data() - W_before).max() << " "
+                  << arma::abs(b.data() - b_before).max() << " " << arma::abs(V.data() - V_before).max()
+                  << std::endl;
+    }
+    {
+        // After the first replay every result, node and buffer of the step is reused: the allocator counters stay
+        // flat across further replays.
+        Malphax::Tensor x(16, 8, "norm", false);
+        Malphax::Tensor W(8, 4, "norm");
+        Malphax::Tensor b(1, 4, "zeros");
+        Malphax::Tensor loss;
+        auto step = Malphax::capture([&]()
+                                     {
+                                         loss = Malphax::mean(Malphax::tanh(Malphax::matmul(x, W) + b));
+                                         loss.backward();
+                                     });
+        step.replay();
+
+        const Malphax::memory::Stats before = Malphax::memory::stats();
+        for (int i = 0; i < 5; ++i) step.replay();
+        const Malphax::memory::Stats after = Malphax::memory::stats();
+
+        std::cout << "Buffers acquired over 5 replays: " << after.acquired - before.acquired << std::endl;
+    }
+    {
+        // A checkpointed segment that returns a view of its argument still gives a result with storage of its own.
+        Malphax::Tensor v(1, 4, "norm");
+        auto vt = Malphax::checkpoint([](const Malphax::Tensor &x) { return Malphax::t(x); }, v);
+        const arma::mat kept = vt.data();
+        Malphax::sum(vt * 3).backward();
+        v.data().zeros();
+        std::cout << "Checkpointed view shares its argument's storage: "
+                  << (vt.data().memptr() == v.data().memptr()) << ", unchanged after the argument was: "
+                  << (arma::abs(vt.data() - kept).max() == 0) << std::endl;
+        std::cout << "Gradient through the checkpointed transpose:\n" << v.grad() << std::endl;
+    }
 
     return 0;
 }